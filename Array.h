@@ -1,13 +1,24 @@
 #pragma once
 
-#include "Types.h"
+#include "Atomically.h"
+#include "Locks.h"
+#include "Simd.h"
 
 #include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
 
 namespace threadsafe {
-template <typename T, std::size_t N> struct Array {
+// Element access is unsynchronized; LockTy guards the whole-array operations
+// (fill, swap and the bulk kernels). The default NullLock keeps Array a
+// zero-overhead aggregate.
+template <typename T, std::size_t N, typename LockTy = NullLock> struct Array {
   using BaseTy = std::array<T, N>;
+  using ReadLockTy = std::shared_lock<LockTy>;
+  using WriteLockTy = std::unique_lock<LockTy>;
   BaseTy Raw;
+  [[no_unique_address]] mutable LockTy TheMutex;
 
 public:
   using value_type = BaseTy::value_type;
@@ -21,15 +32,34 @@ public:
   using const_iterator = BaseTy::const_iterator;
   using reverse_iterator = BaseTy::reverse_iterator;
   using const_reverse_iterator = BaseTy::const_reverse_iterator;
+  using lock_type = LockTy;
 
   THREADSAFE_CONSTEXPR_20
-  void fill(const T &U) { Raw.fill(U); }
+  void fill(const T &U) {
+    if consteval {
+      Raw.fill(U);
+    } else {
+      std::lock_guard Lock(TheMutex);
+      Raw.fill(U);
+    }
+  }
 
   THREADSAFE_CONSTEXPR_20 void
   swap(Array &A) noexcept(std::is_nothrow_swappable_v<T>) {
-    Raw.swap(A);
+    if consteval {
+      Raw.swap(A.Raw);
+    } else {
+      if (this == &A)
+        return;
+      std::scoped_lock Lock(TheMutex, A.TheMutex);
+      Raw.swap(A.Raw);
+    }
   }
 
+  LockTy &mutex() const { return TheMutex; }
+
+  BaseTy &raw() noexcept { return Raw; }
+
   THREADSAFE_CONSTEXPR_20 iterator begin() noexcept { return Raw.begin(); }
 
   THREADSAFE_CONSTEXPR_20 const_iterator begin() const noexcept {
@@ -105,6 +135,55 @@ public:
   THREADSAFE_CONSTEXPR_20 T *data() noexcept { return Raw.data(); }
 
   THREADSAFE_CONSTEXPR_20 const T *data() const noexcept { return Raw.data(); }
+
+  T sum() const
+    requires std::is_arithmetic_v<T>
+  {
+    ReadLockTy Lock(TheMutex);
+    return simd::sum(Raw.data(), N);
+  }
+
+  T min() const
+    requires std::is_arithmetic_v<T> && (N > 0)
+  {
+    ReadLockTy Lock(TheMutex);
+    return simd::min(Raw.data(), N);
+  }
+
+  T max() const
+    requires std::is_arithmetic_v<T> && (N > 0)
+  {
+    ReadLockTy Lock(TheMutex);
+    return simd::max(Raw.data(), N);
+  }
+
+  size_type count(const T &Value) const
+    requires std::is_arithmetic_v<T>
+  {
+    ReadLockTy Lock(TheMutex);
+    return simd::count(Raw.data(), N, Value);
+  }
+
+  size_type find_first_set() const
+    requires std::is_arithmetic_v<T>
+  {
+    ReadLockTy Lock(TheMutex);
+    return simd::find_first_set(Raw.data(), N);
+  }
+
+  void add(const Array &Other)
+    requires std::is_arithmetic_v<T>
+  {
+    if (this == &Other) {
+      std::lock_guard Lock(TheMutex);
+      simd::add(Raw.data(), Raw.data(), N);
+      return;
+    }
+    WriteLockTy Lock1(TheMutex, std::defer_lock);
+    ReadLockTy Lock2(Other.TheMutex, std::defer_lock);
+    std::lock(Lock1, Lock2);
+    simd::add(Raw.data(), Other.Raw.data(), N);
+  }
 };
 
 #if 0
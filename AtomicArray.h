@@ -0,0 +1,175 @@
+#pragma once
+
+#include "Locks.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace threadsafe {
+// Fixed-size array whose slots can be updated concurrently without a global
+// lock. Slots are std::atomic<T> when that is lock-free and plain T guarded by
+// a striped set of LockTy locks otherwise. With Padded, every slot (and stripe
+// lock) gets its own cache line so per-thread counters don't false-share.
+template <typename T, std::size_t N, bool Padded = true,
+          typename LockTy = std::mutex>
+class AtomicArray {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+  static constexpr bool LockFree = std::atomic<T>::is_always_lock_free;
+
+private:
+  using StorageTy = std::conditional_t<LockFree, std::atomic<T>, T>;
+
+  struct alignas(Padded ? CacheLineSize : alignof(StorageTy)) Slot {
+    StorageTy Value{};
+  };
+
+  struct alignas(Padded ? CacheLineSize : alignof(LockTy)) Stripe {
+    LockTy Mutex;
+  };
+
+  struct NoStripes {};
+
+  static constexpr std::size_t NumStripes =
+      std::min<std::size_t>(std::max<std::size_t>(N, 1), 64);
+
+  std::array<Slot, N> Slots;
+  [[no_unique_address]] mutable std::conditional_t<
+      LockFree, NoStripes, std::array<Stripe, NumStripes>>
+      Stripes;
+
+  LockTy &stripe(std::size_t I) const {
+    return Stripes[I % NumStripes].Mutex;
+  }
+
+  static void check(std::size_t I) {
+    if (I >= N)
+      throw std::out_of_range("threadsafe::AtomicArray");
+  }
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  AtomicArray() = default;
+
+  explicit AtomicArray(const T &Value) { fill(Value); }
+
+  AtomicArray(const AtomicArray &) = delete;
+  AtomicArray &operator=(const AtomicArray &) = delete;
+
+  constexpr size_type size() const noexcept { return N; }
+
+  constexpr bool empty() const noexcept { return N == 0; }
+
+  T load(size_type I,
+         std::memory_order Order = std::memory_order_seq_cst) const {
+    if constexpr (LockFree) {
+      return Slots[I].Value.load(Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      return Slots[I].Value;
+    }
+  }
+
+  T at(size_type I) const {
+    check(I);
+    return load(I);
+  }
+
+  void store(size_type I, const T &Value,
+             std::memory_order Order = std::memory_order_seq_cst) {
+    if constexpr (LockFree) {
+      Slots[I].Value.store(Value, Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      Slots[I].Value = Value;
+    }
+  }
+
+  T exchange(size_type I, const T &Value,
+             std::memory_order Order = std::memory_order_seq_cst) {
+    if constexpr (LockFree) {
+      return Slots[I].Value.exchange(Value, Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      return std::exchange(Slots[I].Value, Value);
+    }
+  }
+
+  bool compare_exchange(size_type I, T &Expected, const T &Desired,
+                        std::memory_order Order = std::memory_order_seq_cst) {
+    if constexpr (LockFree) {
+      return Slots[I].Value.compare_exchange_strong(Expected, Desired, Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      if (!(Slots[I].Value == Expected)) {
+        Expected = Slots[I].Value;
+        return false;
+      }
+      Slots[I].Value = Desired;
+      return true;
+    }
+  }
+
+  T fetch_add(size_type I, const T &Arg,
+              std::memory_order Order = std::memory_order_seq_cst)
+    requires std::is_arithmetic_v<T>
+  {
+    if constexpr (LockFree) {
+      return Slots[I].Value.fetch_add(Arg, Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      return std::exchange(Slots[I].Value, Slots[I].Value + Arg);
+    }
+  }
+
+  T fetch_sub(size_type I, const T &Arg,
+              std::memory_order Order = std::memory_order_seq_cst)
+    requires std::is_arithmetic_v<T>
+  {
+    if constexpr (LockFree) {
+      return Slots[I].Value.fetch_sub(Arg, Order);
+    } else {
+      std::lock_guard Lock(stripe(I));
+      return std::exchange(Slots[I].Value, Slots[I].Value - Arg);
+    }
+  }
+
+  // Atomically replaces slot I with Fn(old value) and returns the new value.
+  // Fn may be invoked more than once on the lock-free path.
+  template <typename F> T update(size_type I, F &&Fn) {
+    if constexpr (LockFree) {
+      T Old = Slots[I].Value.load(std::memory_order_relaxed);
+      T New;
+      do
+        New = Fn(Old);
+      while (!Slots[I].Value.compare_exchange_weak(
+          Old, New, std::memory_order_acq_rel, std::memory_order_relaxed));
+      return New;
+    } else {
+      std::lock_guard Lock(stripe(I));
+      Slots[I].Value = Fn(std::as_const(Slots[I].Value));
+      return Slots[I].Value;
+    }
+  }
+
+  // Element-wise only; concurrent writers may interleave with the fill.
+  void fill(const T &Value) {
+    for (size_type I = 0; I != N; ++I)
+      store(I, Value, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  template <typename F> void for_each(F &&Fn) const {
+    for (size_type I = 0; I != N; ++I)
+      Fn(I, load(I, std::memory_order_acquire));
+  }
+};
+} // namespace threadsafe
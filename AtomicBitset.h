@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+namespace threadsafe {
+// Fixed-size bitset with word-level atomic operations. Intended as a lock-free
+// slot allocator: acquire() claims the lowest clear bit, release() frees it.
+template <std::size_t N> class AtomicBitset {
+  using WordTy = std::uint64_t;
+  static constexpr std::size_t WordBits = 64;
+  static constexpr std::size_t NumWords = (N + WordBits - 1) / WordBits;
+
+  std::array<std::atomic<WordTy>, NumWords> Words{};
+
+  static constexpr WordTy bit(std::size_t I) {
+    return WordTy(1) << (I % WordBits);
+  }
+
+  // Bits past N in the last word always read as set so they are never free.
+  static constexpr WordTy tailMask(std::size_t W) {
+    if (W + 1 != NumWords || N % WordBits == 0)
+      return 0;
+    return ~WordTy(0) << (N % WordBits);
+  }
+
+public:
+  using size_type = std::size_t;
+
+  AtomicBitset() = default;
+  AtomicBitset(const AtomicBitset &) = delete;
+  AtomicBitset &operator=(const AtomicBitset &) = delete;
+
+  constexpr size_type size() const noexcept { return N; }
+
+  bool test(size_type I,
+            std::memory_order Order = std::memory_order_acquire) const {
+    return Words[I / WordBits].load(Order) & bit(I);
+  }
+
+  // Returns the previous value of the bit.
+  bool set(size_type I, std::memory_order Order = std::memory_order_acq_rel) {
+    return Words[I / WordBits].fetch_or(bit(I), Order) & bit(I);
+  }
+
+  // Returns the previous value of the bit.
+  bool reset(size_type I,
+             std::memory_order Order = std::memory_order_acq_rel) {
+    return Words[I / WordBits].fetch_and(~bit(I), Order) & bit(I);
+  }
+
+  bool test_and_set(size_type I) { return set(I); }
+
+  bool flip(size_type I, std::memory_order Order = std::memory_order_acq_rel) {
+    return Words[I / WordBits].fetch_xor(bit(I), Order) & bit(I);
+  }
+
+  void clear() {
+    for (auto &W : Words)
+      W.store(0, std::memory_order_release);
+  }
+
+  // Index of the first clear bit, or N if every bit is set. The result may be
+  // stale by the time the caller uses it; acquire() claims it atomically.
+  size_type find_first_free(size_type From = 0) const {
+    for (auto W = From / WordBits; W < NumWords; ++W) {
+      auto Word = Words[W].load(std::memory_order_relaxed) | tailMask(W);
+      if (W == From / WordBits)
+        Word |= bit(From) - 1;
+      if (~Word != 0)
+        return W * WordBits + std::countr_one(Word);
+    }
+    return N;
+  }
+
+  size_type find_first_set(size_type From = 0) const {
+    for (auto W = From / WordBits; W < NumWords; ++W) {
+      auto Word = Words[W].load(std::memory_order_relaxed) & ~tailMask(W);
+      if (W == From / WordBits)
+        Word &= ~(bit(From) - 1);
+      if (Word != 0)
+        return W * WordBits + std::countr_zero(Word);
+    }
+    return N;
+  }
+
+  // Claims the lowest clear bit and returns its index, or N if full.
+  size_type acquire() {
+    for (std::size_t W = 0; W != NumWords; ++W) {
+      auto Word = Words[W].load(std::memory_order_relaxed);
+      while (~(Word | tailMask(W)) != 0) {
+        auto Bit = WordTy(1) << std::countr_one(Word | tailMask(W));
+        if (Words[W].compare_exchange_weak(Word, Word | Bit,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed))
+          return W * WordBits + std::countr_zero(Bit);
+      }
+    }
+    return N;
+  }
+
+  void release(size_type I) { reset(I, std::memory_order_release); }
+
+  size_type count() const {
+    size_type Total = 0;
+    for (std::size_t W = 0; W != NumWords; ++W)
+      Total += std::popcount(Words[W].load(std::memory_order_relaxed) &
+                             ~tailMask(W));
+    return Total;
+  }
+
+  bool any() const { return find_first_set() != N; }
+
+  bool none() const { return !any(); }
+
+  bool all() const { return find_first_free() == N; }
+};
+} // namespace threadsafe
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace threadsafe {
+// Grants atomically() access to a container's lock and underlying storage.
+// Containers befriend this struct and provide TheMutex and raw(); containers
+// with blocked waiters also provide notifyAll().
+struct ContainerAccess {
+  template <typename C> static auto &mutex(C &Container) {
+    return Container.TheMutex;
+  }
+
+  template <typename C> static auto &raw(C &Container) {
+    return Container.raw();
+  }
+
+  template <typename C> static void notify(C &Container) {
+    if constexpr (requires { Container.notifyAll(); })
+      Container.notifyAll();
+  }
+};
+
+namespace detail {
+struct LockEntry {
+  const void *Key;
+  void *Mutex;
+  void (*Lock)(void *);
+  void (*Unlock)(void *);
+};
+
+template <typename C> LockEntry makeLockEntry(C &Container) {
+  using MutexTy = std::remove_cvref_t<decltype(ContainerAccess::mutex(
+      Container))>;
+  return {&Container, &ContainerAccess::mutex(Container),
+          [](void *M) { static_cast<MutexTy *>(M)->lock(); },
+          [](void *M) { static_cast<MutexTy *>(M)->unlock(); }};
+}
+
+template <std::size_t N> class OrderedLocks {
+  std::array<LockEntry, N> Entries;
+  std::size_t Locked = 0;
+
+public:
+  explicit OrderedLocks(std::array<LockEntry, N> E) : Entries(E) {
+    std::sort(Entries.begin(), Entries.end(),
+              [](const LockEntry &A, const LockEntry &B) {
+                return std::less<const void *>()(A.Key, B.Key);
+              });
+    // The same container may be passed more than once; lock it once.
+    auto Last = std::unique(
+        Entries.begin(), Entries.end(),
+        [](const LockEntry &A, const LockEntry &B) { return A.Key == B.Key; });
+    auto Count = static_cast<std::size_t>(Last - Entries.begin());
+    // A lock that throws (MCSLock can run out of queue nodes) leaves us
+    // partly constructed, so the destructor won't release what we hold.
+    try {
+      for (; Locked != Count; ++Locked)
+        Entries[Locked].Lock(Entries[Locked].Mutex);
+    } catch (...) {
+      release();
+      throw;
+    }
+  }
+
+  OrderedLocks(const OrderedLocks &) = delete;
+  OrderedLocks &operator=(const OrderedLocks &) = delete;
+
+  ~OrderedLocks() { release(); }
+
+private:
+  void release() {
+    while (Locked != 0) {
+      --Locked;
+      Entries[Locked].Unlock(Entries[Locked].Mutex);
+    }
+  }
+};
+
+template <typename F, typename... Cs>
+decltype(auto) lockAndApply(F &&Fn, Cs &...Containers) {
+  // Declared first so waiters are woken only after every lock is released.
+  struct Notifier {
+    std::tuple<Cs &...> Refs;
+    ~Notifier() {
+      std::apply([](auto &...C) { (ContainerAccess::notify(C), ...); }, Refs);
+    }
+  } Notify{{Containers...}};
+  OrderedLocks<sizeof...(Cs)> Guard({makeLockEntry(Containers)...});
+  return std::invoke(std::forward<F>(Fn), ContainerAccess::raw(Containers)...);
+}
+} // namespace detail
+
+// atomically(C1, C2, ..., Fn) takes the exclusive lock of every container in a
+// global (address) order, calls Fn with each container's underlying storage
+// (std::unordered_map, std::vector, std::queue, ...) and releases all locks
+// together. Locking by address makes concurrent calls over overlapping sets
+// of containers deadlock-free.
+template <typename... ArgsTy> decltype(auto) atomically(ArgsTy &&...Args) {
+  static_assert(sizeof...(ArgsTy) >= 2,
+                "atomically() needs at least one container and a callable");
+  constexpr auto N = sizeof...(ArgsTy) - 1;
+  auto Refs = std::forward_as_tuple(std::forward<ArgsTy>(Args)...);
+  return [&]<std::size_t... I>(std::index_sequence<I...>) -> decltype(auto) {
+    return detail::lockAndApply(std::get<N>(std::move(Refs)),
+                                std::get<I>(Refs)...);
+  }(std::make_index_sequence<N>());
+}
+} // namespace threadsafe
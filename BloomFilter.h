@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Types.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace threadsafe {
+// Blocked Bloom filter (Putze, Sanders and Singler, "Cache-, Hash-, and
+// Space-Efficient Bloom Filters") in the split-block layout: a key selects one
+// cache-line block and sets one bit in each of its eight 64-bit words, so both
+// insert and lookup touch a single line. Bits are set with atomic fetch_or and
+// read with relaxed loads, so inserts and lookups may run concurrently without
+// a lock. Bits are never cleared; to forget erased keys, build a new filter.
+class BloomFilter {
+  static constexpr std::size_t WordsPerBlock = 8;
+  static constexpr std::size_t BitsPerBlock = WordsPerBlock * 64;
+
+  struct alignas(CacheLineSize) Block {
+    std::array<std::atomic<std::uint64_t>, WordsPerBlock> Words{};
+  };
+
+  // Odd multipliers that pick an independent bit in each word.
+  static constexpr std::array<std::uint32_t, WordsPerBlock> Salts = {
+      0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+  std::size_t Capacity;
+  std::size_t Mask;
+  std::unique_ptr<Block[]> Blocks;
+
+  // Hashers such as std::hash<int> are the identity; spread the bits first.
+  static std::uint64_t mix(std::uint64_t H) {
+    H ^= H >> 30;
+    H *= 0xBF58476D1CE4E5B9ull;
+    H ^= H >> 27;
+    H *= 0x94D049BB133111EBull;
+    H ^= H >> 31;
+    return H;
+  }
+
+  static std::uint64_t bit(std::uint32_t Key, std::size_t Word) {
+    return std::uint64_t(1) << ((Key * Salts[Word]) >> 26);
+  }
+
+public:
+  // Sized for Capacity keys at BitsPerKey bits each, rounded up to a power of
+  // two blocks. Ten bits per key gives a false-positive rate around 1%.
+  explicit BloomFilter(std::size_t Capacity, double BitsPerKey = 10)
+      : Capacity(Capacity),
+        Mask(std::bit_ceil(std::max<std::size_t>(
+                 1, static_cast<std::size_t>(std::ceil(
+                        Capacity * BitsPerKey / BitsPerBlock)))) -
+             1),
+        Blocks(std::make_unique<Block[]>(Mask + 1)) {}
+
+  BloomFilter(const BloomFilter &) = delete;
+  BloomFilter &operator=(const BloomFilter &) = delete;
+
+  void insert(std::uint64_t Hash) {
+    Hash = mix(Hash);
+    auto &B = Blocks[Hash & Mask];
+    auto Key = static_cast<std::uint32_t>(Hash >> 32);
+    for (std::size_t I = 0; I != WordsPerBlock; ++I) {
+      auto Bit = bit(Key, I);
+      // Skip the read-modify-write when the bit is already set, which is the
+      // common case for a filter that is filling up.
+      if (!(B.Words[I].load(std::memory_order_relaxed) & Bit))
+        B.Words[I].fetch_or(Bit, std::memory_order_relaxed);
+    }
+  }
+
+  bool may_contain(std::uint64_t Hash) const {
+    Hash = mix(Hash);
+    auto &B = Blocks[Hash & Mask];
+    auto Key = static_cast<std::uint32_t>(Hash >> 32);
+    bool Hit = true;
+    for (std::size_t I = 0; I != WordsPerBlock; ++I)
+      Hit &= (B.Words[I].load(std::memory_order_relaxed) & bit(Key, I)) != 0;
+    return Hit;
+  }
+
+  std::size_t capacity() const noexcept { return Capacity; }
+
+  std::size_t size_bytes() const noexcept { return (Mask + 1) * sizeof(Block); }
+};
+
+struct BloomFilterStats {
+  bool Enabled = false;
+  std::size_t Capacity = 0;
+  std::size_t Bytes = 0;
+  std::size_t Builds = 0;
+  // Lookups answered by the filter alone.
+  std::uint64_t Rejected = 0;
+  // Lookups the filter let through that then hit.
+  std::uint64_t Passed = 0;
+  // Lookups the filter let through that then missed.
+  std::uint64_t FalsePositives = 0;
+
+  double false_positive_rate() const {
+    auto Negatives = Rejected + FalsePositives;
+    return Negatives ? static_cast<double>(FalsePositives) / Negatives : 0.0;
+  }
+};
+} // namespace threadsafe
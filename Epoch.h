@@ -0,0 +1,160 @@
+#pragma once
+
+#include "Types.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace threadsafe {
+// Epoch-based reclamation for node-based containers whose readers take no
+// locks. A reader pins the domain for as long as it may hold pointers into the
+// structure, and a writer that unlinks a node retires it instead of deleting
+// it. A retired node is freed once the global epoch has advanced twice past
+// its retirement, which cannot happen until every reader pinned at the time
+// has unpinned. A long-lived pin (an iterator kept around, say) therefore
+// delays reclamation but never makes it unsafe.
+class EpochDomain {
+  static constexpr std::size_t NumStripes = 32;
+  static constexpr std::size_t ScanInterval = 64;
+
+  // Pinned-reader counts for the three epochs that can be live at once,
+  // striped by thread so readers on different cores don't share a line.
+  struct alignas(CacheLineSize) Stripe {
+    std::array<std::atomic<std::size_t>, 3> Active{};
+  };
+
+  struct Retired {
+    void *Ptr;
+    void (*Deleter)(void *);
+    std::uint64_t Epoch;
+  };
+
+  std::atomic<std::uint64_t> Epoch{0};
+  std::array<Stripe, NumStripes> Stripes;
+  std::mutex RetireMutex;
+  std::vector<Retired> Limbo;
+  std::size_t SinceScan = 0;
+
+  // Requires RetireMutex. The epoch may move from E to E + 1 once no reader
+  // is still pinned in E - 1.
+  bool tryAdvance() {
+    auto E = Epoch.load();
+    for (auto &S : Stripes)
+      if (S.Active[(E + 2) % 3].load() != 0)
+        return false;
+    Epoch.store(E + 1);
+    return true;
+  }
+
+  // Requires RetireMutex. Moves every node that is safe to free into Expired
+  // so the deleters can run without the lock held.
+  void collect(std::vector<Retired> &Expired) {
+    for (int Step = 0; Step != 2 && tryAdvance(); ++Step)
+      ;
+    auto Now = Epoch.load();
+    auto It = std::partition(Limbo.begin(), Limbo.end(), [Now](auto &R) {
+      return R.Epoch + 2 > Now;
+    });
+    Expired.assign(It, Limbo.end());
+    Limbo.erase(It, Limbo.end());
+  }
+
+public:
+  class Guard {
+    std::atomic<std::size_t> *Counter = nullptr;
+
+    friend class EpochDomain;
+    explicit Guard(std::atomic<std::size_t> *C) : Counter(C) {}
+
+  public:
+    Guard() = default;
+
+    // A copy joins the same epoch, which can't be reclaimed while the
+    // original is alive.
+    Guard(const Guard &Other) : Counter(Other.Counter) {
+      if (Counter)
+        Counter->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Guard(Guard &&Other) noexcept
+        : Counter(std::exchange(Other.Counter, nullptr)) {}
+
+    Guard &operator=(Guard Other) noexcept {
+      std::swap(Counter, Other.Counter);
+      return *this;
+    }
+
+    ~Guard() { reset(); }
+
+    void reset() {
+      if (Counter)
+        std::exchange(Counter, nullptr)
+            ->fetch_sub(1, std::memory_order_release);
+    }
+
+    explicit operator bool() const { return Counter != nullptr; }
+  };
+
+  EpochDomain() = default;
+  EpochDomain(const EpochDomain &) = delete;
+  EpochDomain &operator=(const EpochDomain &) = delete;
+
+  // No guard may outlive the domain.
+  ~EpochDomain() {
+    for (auto &R : Limbo)
+      R.Deleter(R.Ptr);
+  }
+
+  Guard pin() {
+    auto &S = Stripes[threadHash() % NumStripes];
+    for (;;) {
+      auto E = Epoch.load();
+      auto &C = S.Active[E % 3];
+      C.fetch_add(1);
+      // Re-check so a reader that raced with an advance never counts itself
+      // in an epoch that's already being drained.
+      if (Epoch.load() == E)
+        return Guard(&C);
+      C.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // Ptr must already be unreachable for new readers.
+  void retire(void *Ptr, void (*Deleter)(void *)) {
+    std::vector<Retired> Expired;
+    {
+      std::lock_guard Lock(RetireMutex);
+      Limbo.push_back({Ptr, Deleter, Epoch.load()});
+      if (++SinceScan < ScanInterval)
+        return;
+      SinceScan = 0;
+      collect(Expired);
+    }
+    for (auto &R : Expired)
+      R.Deleter(R.Ptr);
+  }
+
+  // Frees whatever can be freed now instead of waiting for the next scan.
+  void reclaim() {
+    std::vector<Retired> Expired;
+    {
+      std::lock_guard Lock(RetireMutex);
+      SinceScan = 0;
+      collect(Expired);
+    }
+    for (auto &R : Expired)
+      R.Deleter(R.Ptr);
+  }
+
+  std::size_t pending() {
+    std::lock_guard Lock(RetireMutex);
+    return Limbo.size();
+  }
+};
+} // namespace threadsafe
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "Types.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+
+namespace threadsafe {
+struct CombiningStats {
+  bool Enabled = false;
+  // Operations run by a combiner on behalf of their callers.
+  std::uint64_t Combined = 0;
+  // Times a thread took the combiner role.
+  std::uint64_t Sessions = 0;
+  // Operations that found every slot busy and took the lock themselves.
+  std::uint64_t Direct = 0;
+
+  double batch_size() const {
+    return Sessions ? static_cast<double>(Combined) / Sessions : 0.0;
+  }
+};
+
+// Flat combining (Hendler et al., "Flat Combining and the
+// Synchronization-Parallelism Tradeoff") over an existing lock. A caller
+// publishes its operation in a request slot and waits on that slot. Whichever
+// waiter gets the lock becomes the combiner. It runs every pending request in
+// one session, so the protected data stays in its cache instead of following
+// the lock from core to core. Code that takes the lock directly stays
+// correct, since the combiner holds the same lock.
+//
+// Asynchronous requests are served by whichever combiner comes along next,
+// or by a server thread started by the first submit().
+template <typename LockTy> class FlatCombiner {
+  static constexpr std::size_t NumSlots = 64;
+  // A session ends after a pass that finds nothing to do, or after this many
+  // passes so the combiner's own caller isn't held up forever.
+  static constexpr unsigned MaxPasses = 4;
+  // Waiters check their slot this many times between attempts at the lock.
+  static constexpr unsigned SpinsPerAttempt = 16;
+
+  struct Request {
+    void (*Run)(Request *);
+    bool Async;
+  };
+
+  enum State : unsigned { Free, Claimed, Pending, Done };
+
+  struct alignas(CacheLineSize) Slot {
+    std::atomic<unsigned> State{Free};
+    Request *Req = nullptr;
+  };
+
+  template <typename Fn> class SyncRequest : public Request {
+    using ResultTy = std::invoke_result_t<Fn &>;
+    using StoredTy = std::conditional_t<std::is_reference_v<ResultTy>,
+                                        std::remove_reference_t<ResultTy> *,
+                                        ResultTy>;
+
+    Fn &F;
+    std::conditional_t<std::is_void_v<ResultTy>, bool,
+                       std::optional<StoredTy>>
+        Result{};
+    std::exception_ptr Error;
+
+    static void run(Request *Base) {
+      auto *Self = static_cast<SyncRequest *>(Base);
+      try {
+        if constexpr (std::is_void_v<ResultTy>)
+          Self->F();
+        else if constexpr (std::is_reference_v<ResultTy>)
+          Self->Result.emplace(std::addressof(Self->F()));
+        else
+          Self->Result.emplace(Self->F());
+      } catch (...) {
+        Self->Error = std::current_exception();
+      }
+    }
+
+  public:
+    explicit SyncRequest(Fn &F) : Request{&run, false}, F(F) {}
+
+    ResultTy get() {
+      if (Error)
+        std::rethrow_exception(Error);
+      if constexpr (std::is_reference_v<ResultTy>)
+        return static_cast<ResultTy>(**Result);
+      else if constexpr (!std::is_void_v<ResultTy>)
+        return std::move(*Result);
+    }
+  };
+
+  template <typename Fn> class AsyncRequest : public Request {
+    using ResultTy = std::invoke_result_t<Fn &>;
+
+    Fn F;
+    std::promise<ResultTy> Promise;
+
+    // Owns the request from here on.
+    static void run(Request *Base) {
+      std::unique_ptr<AsyncRequest> Self(static_cast<AsyncRequest *>(Base));
+      try {
+        if constexpr (std::is_void_v<ResultTy>) {
+          Self->F();
+          Self->Promise.set_value();
+        } else {
+          Self->Promise.set_value(Self->F());
+        }
+      } catch (...) {
+        Self->Promise.set_exception(std::current_exception());
+      }
+    }
+
+  public:
+    explicit AsyncRequest(Fn F) : Request{&run, true}, F(std::move(F)) {}
+
+    std::future<ResultTy> future() { return Promise.get_future(); }
+  };
+
+  LockTy &Mutex;
+  std::array<Slot, NumSlots> Slots;
+  // Asynchronous requests published and not yet run.
+  std::atomic<std::size_t> Queued{0};
+  // Bumped on every submit() so the server can sleep on it.
+  std::atomic<std::uint32_t> Wakeups{0};
+  std::once_flag ServerStarted;
+  std::jthread Server;
+
+  // Written by the combiner under the lock; read by stats().
+  std::atomic<std::uint64_t> Combined{0};
+  std::atomic<std::uint64_t> Sessions{0};
+  std::atomic<std::uint64_t> Direct{0};
+
+  // Claims a free slot, starting from the calling thread's own.
+  Slot *claim() {
+    auto Home = threadHash() % NumSlots;
+    for (std::size_t I = 0; I != NumSlots; ++I) {
+      auto &S = Slots[(Home + I) % NumSlots];
+      unsigned Expected = Free;
+      if (S.State.load(std::memory_order_relaxed) == Free &&
+          S.State.compare_exchange_strong(Expected, Claimed,
+                                          std::memory_order_acquire))
+        return &S;
+    }
+    return nullptr;
+  }
+
+  static void publish(Slot &S, Request &R) {
+    S.Req = &R;
+    S.State.store(Pending, std::memory_order_release);
+  }
+
+  // Requires Mutex held exclusively.
+  void combine() {
+    std::uint64_t Ran = 0;
+    for (unsigned Pass = 0; Pass != MaxPasses; ++Pass) {
+      std::uint64_t Before = Ran;
+      for (auto &S : Slots) {
+        if (S.State.load(std::memory_order_acquire) != Pending)
+          continue;
+        auto *R = S.Req;
+        // An async request frees itself in Run, so read the flag first.
+        bool Async = R->Async;
+        R->Run(R);
+        S.State.store(Async ? Free : Done, std::memory_order_release);
+        if (Async)
+          Queued.fetch_sub(1, std::memory_order_relaxed);
+        ++Ran;
+      }
+      if (Ran == Before)
+        break;
+    }
+    Sessions.fetch_add(1, std::memory_order_relaxed);
+    Combined.fetch_add(Ran, std::memory_order_relaxed);
+  }
+
+  void serve(std::stop_token Stop) {
+    for (;;) {
+      auto Seen = Wakeups.load(std::memory_order_acquire);
+      if (Queued.load(std::memory_order_acquire) != 0) {
+        std::lock_guard Lock(Mutex);
+        combine();
+        continue;
+      }
+      // Everything submitted so far has run, so stopping drops nothing.
+      if (Stop.stop_requested())
+        return;
+      Wakeups.wait(Seen, std::memory_order_acquire);
+    }
+  }
+
+public:
+  explicit FlatCombiner(LockTy &Mutex) : Mutex(Mutex) {}
+
+  FlatCombiner(const FlatCombiner &) = delete;
+  FlatCombiner &operator=(const FlatCombiner &) = delete;
+
+  // Runs whatever was submitted and not yet run before returning.
+  ~FlatCombiner() {
+    if (!Server.joinable())
+      return;
+    Server.request_stop();
+    Wakeups.fetch_add(1, std::memory_order_release);
+    Wakeups.notify_one();
+    Server.join();
+  }
+
+  // Runs F with the lock held exclusively, possibly on another thread, and
+  // returns its result or rethrows its exception.
+  template <typename Fn> decltype(auto) execute(Fn &&F) {
+    using FnTy = std::remove_reference_t<Fn>;
+    auto *S = claim();
+    if (!S) {
+      Direct.fetch_add(1, std::memory_order_relaxed);
+      std::lock_guard Lock(Mutex);
+      return std::invoke(F);
+    }
+
+    SyncRequest<FnTy> R(F);
+    publish(*S, R);
+    for (unsigned Spin = 0;
+         S->State.load(std::memory_order_acquire) != Done; ++Spin) {
+      if (Spin % SpinsPerAttempt == 0 && Mutex.try_lock()) {
+        std::lock_guard Lock(Mutex, std::adopt_lock);
+        // Our request was published first, so this session runs it.
+        combine();
+      } else if (Spin < 1024) {
+        cpuRelax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    S->State.store(Free, std::memory_order_release);
+    return R.get();
+  }
+
+  // Queues F to run with the lock held exclusively and returns a future for
+  // its result. F is moved into the request.
+  template <typename Fn>
+  std::future<std::invoke_result_t<std::decay_t<Fn> &>> submit(Fn &&F) {
+    auto R = std::make_unique<AsyncRequest<std::decay_t<Fn>>>(
+        std::forward<Fn>(F));
+    auto Future = R->future();
+    std::call_once(ServerStarted, [this] {
+      Server = std::jthread([this](std::stop_token Stop) { serve(Stop); });
+    });
+    auto *S = claim();
+    if (!S) {
+      Direct.fetch_add(1, std::memory_order_relaxed);
+      std::lock_guard Lock(Mutex);
+      auto *Raw = R.release();
+      Raw->Run(Raw);
+      return Future;
+    }
+
+    Queued.fetch_add(1, std::memory_order_relaxed);
+    publish(*S, *R.release());
+    Wakeups.fetch_add(1, std::memory_order_release);
+    Wakeups.notify_one();
+    return Future;
+  }
+
+  CombiningStats stats() const {
+    CombiningStats S;
+    S.Combined = Combined.load(std::memory_order_relaxed);
+    S.Sessions = Sessions.load(std::memory_order_relaxed);
+    S.Direct = Direct.load(std::memory_order_relaxed);
+    return S;
+  }
+};
+} // namespace threadsafe
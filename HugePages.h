@@ -0,0 +1,390 @@
+#pragma once
+
+#include "Locks.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace threadsafe {
+inline constexpr std::size_t HugePageSize = std::size_t(2) << 20;
+
+// How a huge-page mapping ended up being backed.
+enum class PageKind {
+  // Transparent huge pages requested with madvise(MADV_HUGEPAGE). The kernel
+  // may still back parts with small pages, e.g. when memory is fragmented.
+  Transparent,
+  // Explicit huge pages from the hugetlbfs pool (vm.nr_hugepages).
+  HugeTlb,
+  // Neither was available: ordinary 4 KiB pages.
+  Normal,
+};
+
+// Process-wide totals for memory mapped through HugePageAllocator.
+struct HugePageStats {
+  std::size_t TransparentBytes = 0;
+  std::size_t HugeTlbBytes = 0;
+  std::size_t NormalBytes = 0;
+  // Of TransparentBytes, what the kernel actually backs with huge pages
+  // right now, from /proc/self/smaps. 0 where that can't be read.
+  std::size_t TransparentResident = 0;
+  std::size_t Mappings = 0;
+  // Mid-sized allocations left to the upstream allocator; see
+  // HugePageAllocator.
+  std::size_t UpstreamBytes = 0;
+
+  std::size_t mapped() const {
+    return TransparentBytes + HugeTlbBytes + NormalBytes;
+  }
+};
+
+namespace detail {
+// Every mapping made for HugePageAllocator, so that frees can be booked
+// against the right kind and stats can find the regions in smaps.
+class HugePageRegistry {
+  struct Region {
+    std::size_t Bytes;
+    PageKind Kind;
+  };
+
+  std::mutex Mutex;
+  std::map<std::uintptr_t, Region> Regions;
+  std::array<std::size_t, 3> Totals{};
+  std::atomic<std::size_t> Upstream{0};
+  bool Transparent;
+
+  static bool transparentEnabled() {
+    // "[never]" means madvise() succeeds and does nothing.
+    auto *F = std::fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!F)
+      return false;
+    char Buf[128] = {};
+    auto N = std::fread(Buf, 1, sizeof(Buf) - 1, F);
+    std::fclose(F);
+    return N != 0 && !std::strstr(Buf, "[never]");
+  }
+
+#ifdef __linux__
+  // Maps Bytes at a HugePageSize boundary so that every 2 MiB of the region
+  // can become one huge page, then asks for transparent huge pages.
+  static void *mapTransparent(std::size_t Bytes) {
+    auto Span = Bytes + HugePageSize;
+    void *P = mmap(nullptr, Span, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (P == MAP_FAILED)
+      return nullptr;
+    auto Start = reinterpret_cast<std::uintptr_t>(P);
+    auto Aligned = (Start + HugePageSize - 1) & ~(HugePageSize - 1);
+    if (Aligned != Start)
+      munmap(P, Aligned - Start);
+    if (auto Tail = Start + Span - (Aligned + Bytes))
+      munmap(reinterpret_cast<void *>(Aligned + Bytes), Tail);
+    P = reinterpret_cast<void *>(Aligned);
+    if (madvise(P, Bytes, MADV_HUGEPAGE) != 0) {
+      munmap(P, Bytes);
+      return nullptr;
+    }
+    return P;
+  }
+
+  static void *mapHugeTlb(std::size_t Bytes) {
+    void *P = mmap(nullptr, Bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return P == MAP_FAILED ? nullptr : P;
+  }
+
+  static void *mapNormal(std::size_t Bytes) {
+    void *P = mmap(nullptr, Bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return P == MAP_FAILED ? nullptr : P;
+  }
+#endif
+
+  HugePageRegistry() : Transparent(transparentEnabled()) {}
+
+  // Sums AnonHugePages over the smaps entries that start inside one of our
+  // regions. A region split by the kernel shows up as several entries.
+  std::size_t transparentResident(
+      const std::vector<std::pair<std::uintptr_t, std::size_t>> &Ranges) {
+    auto *F = std::fopen("/proc/self/smaps", "r");
+    if (!F)
+      return 0;
+    std::size_t Total = 0;
+    bool Ours = false;
+    char Line[512];
+    while (std::fgets(Line, sizeof(Line), F)) {
+      unsigned long long Lo, Hi, Kb;
+      if (std::sscanf(Line, "%llx-%llx ", &Lo, &Hi) == 2) {
+        auto It = std::upper_bound(
+            Ranges.begin(), Ranges.end(), static_cast<std::uintptr_t>(Lo),
+            [](std::uintptr_t A, const auto &R) { return A < R.first; });
+        Ours = It != Ranges.begin() && Lo < std::prev(It)->first +
+                                                std::prev(It)->second;
+      } else if (Ours &&
+                 std::sscanf(Line, "AnonHugePages: %llu kB", &Kb) == 1) {
+        Total += Kb * 1024;
+      }
+    }
+    std::fclose(F);
+    return Total;
+  }
+
+public:
+  // Never destroyed, like MemoryRegistry.
+  static HugePageRegistry &instance() {
+    static auto *Registry = new HugePageRegistry;
+    return *Registry;
+  }
+
+  // Maps Bytes, a multiple of HugePageSize, trying transparent huge pages,
+  // then hugetlbfs, then small pages. Throws std::bad_alloc if all fail.
+  void *map(std::size_t Bytes) {
+    void *P = nullptr;
+    auto Kind = PageKind::Normal;
+#ifdef __linux__
+    if (Transparent && (P = mapTransparent(Bytes)))
+      Kind = PageKind::Transparent;
+    else if ((P = mapHugeTlb(Bytes)))
+      Kind = PageKind::HugeTlb;
+    else
+      P = mapNormal(Bytes);
+#else
+    P = ::operator new(Bytes, std::align_val_t(HugePageSize), std::nothrow);
+#endif
+    if (!P)
+      throw std::bad_alloc();
+    std::lock_guard Lock(Mutex);
+    Regions.emplace(reinterpret_cast<std::uintptr_t>(P), Region{Bytes, Kind});
+    Totals[static_cast<unsigned>(Kind)] += Bytes;
+    return P;
+  }
+
+  // Returns false if P wasn't mapped by map().
+  bool unmap(void *P) {
+    std::size_t Size;
+    {
+      std::lock_guard Lock(Mutex);
+      auto It = Regions.find(reinterpret_cast<std::uintptr_t>(P));
+      if (It == Regions.end())
+        return false;
+      Size = It->second.Bytes;
+      Totals[static_cast<unsigned>(It->second.Kind)] -= Size;
+      Regions.erase(It);
+    }
+#ifdef __linux__
+    munmap(P, Size);
+#else
+    ::operator delete(P, std::align_val_t(HugePageSize));
+#endif
+    return true;
+  }
+
+  void noteUpstream(std::ptrdiff_t Delta) {
+    Upstream.fetch_add(static_cast<std::size_t>(Delta),
+                       std::memory_order_relaxed);
+  }
+
+  // Reads /proc/self/smaps, so it is not for hot paths.
+  HugePageStats stats() {
+    HugePageStats S;
+    std::vector<std::pair<std::uintptr_t, std::size_t>> Ranges;
+    {
+      std::lock_guard Lock(Mutex);
+      S.TransparentBytes = Totals[static_cast<unsigned>(PageKind::Transparent)];
+      S.HugeTlbBytes = Totals[static_cast<unsigned>(PageKind::HugeTlb)];
+      S.NormalBytes = Totals[static_cast<unsigned>(PageKind::Normal)];
+      S.Mappings = Regions.size();
+      for (auto &[Start, R] : Regions)
+        if (R.Kind == PageKind::Transparent)
+          Ranges.emplace_back(Start, R.Bytes);
+    }
+    S.UpstreamBytes = Upstream.load(std::memory_order_relaxed);
+    if (!Ranges.empty())
+      S.TransparentResident = transparentResident(Ranges);
+    return S;
+  }
+};
+
+// Small-object pool carved out of huge-page chunks, shared by one
+// HugePageAllocator and its copies and rebinds. Blocks come in 16-byte size
+// classes and freed blocks are reused within their class; chunks go back to
+// the kernel only when the pool dies, i.e. with the container.
+class HugePagePool {
+public:
+  static constexpr std::size_t Granule = 16;
+  static constexpr std::size_t MaxBlock = 256;
+
+private:
+  struct FreeBlock {
+    FreeBlock *Next;
+  };
+
+  SpinLock Mutex;
+  std::array<FreeBlock *, MaxBlock / Granule> FreeLists{};
+  std::vector<void *> Chunks;
+  char *Cursor = nullptr;
+  char *End = nullptr;
+
+  // Zero-byte requests share the smallest class, so each still gets a
+  // distinct block.
+  static std::size_t sizeClass(std::size_t Bytes) {
+    return (std::max<std::size_t>(Bytes, 1) + Granule - 1) / Granule - 1;
+  }
+
+public:
+  HugePagePool() = default;
+  HugePagePool(const HugePagePool &) = delete;
+  HugePagePool &operator=(const HugePagePool &) = delete;
+
+  ~HugePagePool() {
+    for (auto *C : Chunks)
+      HugePageRegistry::instance().unmap(C);
+  }
+
+  void *allocate(std::size_t Bytes) {
+    auto Class = sizeClass(Bytes);
+    std::lock_guard Lock(Mutex);
+    if (auto *B = FreeLists[Class]) {
+      FreeLists[Class] = B->Next;
+      return B;
+    }
+    auto Size = (Class + 1) * Granule;
+    if (static_cast<std::size_t>(End - Cursor) < Size) {
+      Chunks.reserve(Chunks.size() + 1);
+      Cursor = static_cast<char *>(
+          HugePageRegistry::instance().map(HugePageSize));
+      End = Cursor + HugePageSize;
+      Chunks.push_back(Cursor);
+    }
+    return std::exchange(Cursor, Cursor + Size);
+  }
+
+  void deallocate(void *P, std::size_t Bytes) {
+    auto Class = sizeClass(Bytes);
+    std::lock_guard Lock(Mutex);
+    FreeLists[Class] = new (P) FreeBlock{FreeLists[Class]};
+  }
+};
+} // namespace detail
+
+// Allocator that puts a container's storage on 2 MiB pages, so that random
+// access over a large container takes far fewer TLB misses. Requests of
+// LargeThreshold bytes or more, such as vector buffers and bucket arrays,
+// get mappings of their own, rounded up to whole huge pages. Requests of up
+// to detail::HugePagePool::MaxBlock bytes, such as hash and list nodes, come
+// from a pool of huge-page chunks. Sizes in between are too big to pool and
+// too small to be worth a huge page, so they go to Upstream.
+//
+// Each mapping tries transparent huge pages first, then hugetlbfs, then
+// falls back to ordinary pages, so the allocator works everywhere; see
+// hugePageStats() for what was actually obtained. Like TrackingAllocator, a
+// default-constructed allocator starts its own pool and a container copy
+// gets a fresh one. The two compose, e.g.
+// TrackingAllocator<T, HugePageAllocator<T>>.
+template <typename T, typename Upstream = std::allocator<T>>
+class HugePageAllocator {
+  using UpstreamTraits = std::allocator_traits<Upstream>;
+
+  template <typename, typename> friend class HugePageAllocator;
+
+  [[no_unique_address]] Upstream Up;
+  std::shared_ptr<detail::HugePagePool> Pool;
+
+  static constexpr bool Poolable =
+      alignof(T) <= detail::HugePagePool::Granule;
+
+public:
+  // Half a huge page: at worst half of the last page goes unused.
+  static constexpr std::size_t LargeThreshold = HugePageSize / 2;
+
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U> struct rebind {
+    using other =
+        HugePageAllocator<U, typename UpstreamTraits::template rebind_alloc<U>>;
+  };
+
+  HugePageAllocator() : HugePageAllocator(Upstream()) {}
+
+  explicit HugePageAllocator(const Upstream &Up)
+      : Up(Up), Pool(std::make_shared<detail::HugePagePool>()) {}
+
+  // No move constructor: a moved-from container must keep a working pool.
+  HugePageAllocator(const HugePageAllocator &) = default;
+  HugePageAllocator &operator=(const HugePageAllocator &) = default;
+
+  template <typename U, typename UpstreamU>
+  HugePageAllocator(const HugePageAllocator<U, UpstreamU> &Other) noexcept
+      : Up(Other.Up), Pool(Other.Pool) {}
+
+  // Leaves room to round the largest request up to a whole huge page.
+  std::size_t max_size() const noexcept {
+    return (std::numeric_limits<std::size_t>::max() - HugePageSize) /
+           sizeof(T);
+  }
+
+  T *allocate(std::size_t N) {
+    if (N > max_size())
+      throw std::bad_array_new_length();
+    auto Bytes = N * sizeof(T);
+    if (Bytes >= LargeThreshold) {
+      auto Rounded = (Bytes + HugePageSize - 1) & ~(HugePageSize - 1);
+      return static_cast<T *>(
+          detail::HugePageRegistry::instance().map(Rounded));
+    }
+    if (Poolable && Bytes <= detail::HugePagePool::MaxBlock)
+      return static_cast<T *>(Pool->allocate(Bytes));
+    auto *P = UpstreamTraits::allocate(Up, N);
+    detail::HugePageRegistry::instance().noteUpstream(
+        static_cast<std::ptrdiff_t>(Bytes));
+    return P;
+  }
+
+  void deallocate(T *P, std::size_t N) {
+    auto Bytes = N * sizeof(T);
+    if (Bytes >= LargeThreshold) {
+      detail::HugePageRegistry::instance().unmap(P);
+    } else if (Poolable && Bytes <= detail::HugePagePool::MaxBlock) {
+      Pool->deallocate(P, Bytes);
+    } else {
+      detail::HugePageRegistry::instance().noteUpstream(
+          -static_cast<std::ptrdiff_t>(Bytes));
+      UpstreamTraits::deallocate(Up, P, N);
+    }
+  }
+
+  HugePageAllocator select_on_container_copy_construction() const {
+    return HugePageAllocator(
+        UpstreamTraits::select_on_container_copy_construction(Up));
+  }
+
+  template <typename U, typename UpstreamU>
+  bool operator==(const HugePageAllocator<U, UpstreamU> &Other) const {
+    return Pool == Other.Pool;
+  }
+};
+
+// What HugePageAllocator has mapped, process-wide, and how it is backed.
+inline HugePageStats hugePageStats() {
+  return detail::HugePageRegistry::instance().stats();
+}
+} // namespace threadsafe
@@ -0,0 +1,338 @@
+#pragma once
+
+#include "Types.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+
+// Lock policies for the threadsafe containers. Every policy models
+// SharedLockable so containers can use std::shared_lock for readers and
+// std::unique_lock/std::lock_guard for writers regardless of the policy;
+// exclusive-only locks simply treat shared acquisition as exclusive.
+namespace threadsafe {
+template <typename Derived> class ExclusiveLock {
+public:
+  void lock_shared() { static_cast<Derived *>(this)->lock(); }
+  bool try_lock_shared() { return static_cast<Derived *>(this)->try_lock(); }
+  void unlock_shared() { static_cast<Derived *>(this)->unlock(); }
+};
+
+// Test-and-test-and-set spinlock for very short critical sections.
+class SpinLock : public ExclusiveLock<SpinLock> {
+  std::atomic<bool> Locked{false};
+
+public:
+  SpinLock() = default;
+  SpinLock(const SpinLock &) = delete;
+  SpinLock &operator=(const SpinLock &) = delete;
+
+  void lock() {
+    for (;;) {
+      if (!Locked.exchange(true, std::memory_order_acquire))
+        return;
+      Backoff B;
+      while (Locked.load(std::memory_order_relaxed))
+        B.pause();
+    }
+  }
+
+  bool try_lock() {
+    return !Locked.load(std::memory_order_relaxed) &&
+           !Locked.exchange(true, std::memory_order_acquire);
+  }
+
+  void unlock() { Locked.store(false, std::memory_order_release); }
+};
+
+// FIFO-fair ticket lock.
+class TicketLock : public ExclusiveLock<TicketLock> {
+  alignas(CacheLineSize) std::atomic<std::uint32_t> NextTicket{0};
+  alignas(CacheLineSize) std::atomic<std::uint32_t> NowServing{0};
+
+public:
+  TicketLock() = default;
+  TicketLock(const TicketLock &) = delete;
+  TicketLock &operator=(const TicketLock &) = delete;
+
+  void lock() {
+    auto Ticket = NextTicket.fetch_add(1, std::memory_order_relaxed);
+    Backoff B;
+    while (NowServing.load(std::memory_order_acquire) != Ticket)
+      B.pause();
+  }
+
+  bool try_lock() {
+    auto Serving = NowServing.load(std::memory_order_relaxed);
+    auto Expected = Serving;
+    return NextTicket.compare_exchange_strong(Expected, Serving + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+  }
+
+  void unlock() {
+    NowServing.store(NowServing.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+  }
+};
+
+// Mellor-Crummey/Scott queue lock. Each waiter spins on its own node, so a
+// handoff touches only the successor's cache line. Queue nodes come from a
+// small per-thread pool, which bounds how many MCS locks one thread may hold
+// at once.
+class MCSLock : public ExclusiveLock<MCSLock> {
+  struct alignas(CacheLineSize) Node {
+    std::atomic<Node *> Next{nullptr};
+    std::atomic<bool> Locked{false};
+    bool InUse = false;
+  };
+
+  static constexpr std::size_t MaxHeld = 16;
+
+  std::atomic<Node *> Tail{nullptr};
+  // Only touched by the current holder.
+  Node *Holder = nullptr;
+
+  static Node *acquireNode() {
+    thread_local std::array<Node, MaxHeld> Pool;
+    for (auto &N : Pool)
+      if (!N.InUse) {
+        N.InUse = true;
+        N.Next.store(nullptr, std::memory_order_relaxed);
+        N.Locked.store(true, std::memory_order_relaxed);
+        return &N;
+      }
+    throw std::length_error("threadsafe::MCSLock: too many locks held");
+  }
+
+  static void releaseNode(Node *N) { N->InUse = false; }
+
+public:
+  MCSLock() = default;
+  MCSLock(const MCSLock &) = delete;
+  MCSLock &operator=(const MCSLock &) = delete;
+
+  void lock() {
+    auto *Self = acquireNode();
+    if (auto *Prev = Tail.exchange(Self, std::memory_order_acq_rel)) {
+      Prev->Next.store(Self, std::memory_order_release);
+      Backoff B;
+      while (Self->Locked.load(std::memory_order_acquire))
+        B.pause();
+    }
+    Holder = Self;
+  }
+
+  bool try_lock() {
+    auto *Self = acquireNode();
+    Node *Expected = nullptr;
+    if (Tail.compare_exchange_strong(Expected, Self, std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+      Holder = Self;
+      return true;
+    }
+    releaseNode(Self);
+    return false;
+  }
+
+  void unlock() {
+    auto *Self = Holder;
+    auto *Next = Self->Next.load(std::memory_order_acquire);
+    if (!Next) {
+      auto *Expected = Self;
+      if (Tail.compare_exchange_strong(Expected, nullptr,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+        releaseNode(Self);
+        return;
+      }
+      // A successor has swung Tail but not linked itself in yet.
+      Backoff B;
+      while (!(Next = Self->Next.load(std::memory_order_acquire)))
+        B.pause();
+    }
+    Next->Locked.store(false, std::memory_order_release);
+    releaseNode(Self);
+  }
+};
+
+// Reader-writer lock backed by std::shared_mutex; the default policy.
+class SharedMutexLock {
+  std::shared_mutex Mutex;
+
+public:
+  SharedMutexLock() = default;
+  SharedMutexLock(const SharedMutexLock &) = delete;
+  SharedMutexLock &operator=(const SharedMutexLock &) = delete;
+
+  void lock() { Mutex.lock(); }
+  bool try_lock() { return Mutex.try_lock(); }
+  void unlock() { Mutex.unlock(); }
+  void lock_shared() { Mutex.lock_shared(); }
+  bool try_lock_shared() { return Mutex.try_lock_shared(); }
+  void unlock_shared() { Mutex.unlock_shared(); }
+};
+
+// No synchronization at all, for single-threaded phases or externally
+// serialized use.
+class NullLock {
+public:
+  constexpr void lock() noexcept {}
+  constexpr bool try_lock() noexcept { return true; }
+  constexpr void unlock() noexcept {}
+  constexpr void lock_shared() noexcept {}
+  constexpr bool try_lock_shared() noexcept { return true; }
+  constexpr void unlock_shared() noexcept {}
+};
+
+// Reader-biased wrapper around a reader-writer lock, after BRAVO (Dice and
+// Kogan, "BRAVO: Biased Locking for Reader-Writer Locks"). While the lock is
+// read-biased a reader publishes itself in one slot of a global, cache-line
+// padded table hashed by (thread, lock) and never writes to the lock itself,
+// so concurrent readers on different cores don't share a cache line. A writer
+// acquires the underlying lock, revokes the bias and waits for the table to
+// drain of this lock; the bias is then inhibited for a multiple of the
+// revocation time so write-heavy phases fall back to the underlying lock.
+template <typename UnderlyingTy = SharedMutexLock> class BravoLock {
+  struct alignas(CacheLineSize) Slot {
+    std::atomic<const void *> Owner{nullptr};
+  };
+
+  static constexpr std::size_t TableSize = 1024;
+  static constexpr std::int64_t InhibitMultiplier = 9;
+
+  static inline std::array<Slot, TableSize> Table;
+
+  std::atomic<bool> ReadBias{true};
+  std::atomic<std::int64_t> InhibitUntil{0};
+  UnderlyingTy Underlying;
+
+  static std::int64_t now() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+  }
+
+  Slot &slot() const {
+    thread_local const std::uint64_t ThreadSeed =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) *
+        0x9E3779B97F4A7C15ull;
+    auto H = ThreadSeed ^ (reinterpret_cast<std::uintptr_t>(this) >> 6);
+    H ^= H >> 29;
+    H *= 0xBF58476D1CE4E5B9ull;
+    H ^= H >> 32;
+    return Table[H % TableSize];
+  }
+
+  // Locks the calling thread currently holds through the fast path. Another
+  // thread may hash to the same slot for the same lock, so the slot contents
+  // alone can't tell unlock_shared() which path was taken.
+  struct FastHeld {
+    std::array<const BravoLock *, 8> Locks{};
+    std::size_t Count = 0;
+  };
+
+  static FastHeld &fastHeld() {
+    thread_local FastHeld Held;
+    return Held;
+  }
+
+  bool tryFastRead() {
+    if (!ReadBias.load(std::memory_order_acquire))
+      return false;
+    auto &Held = fastHeld();
+    if (Held.Count == Held.Locks.size())
+      return false;
+    auto &S = slot();
+    const void *Expected = nullptr;
+    if (!S.Owner.compare_exchange_strong(Expected, this))
+      return false;
+    // Re-check after publishing; pairs with the revocation in lock().
+    if (!ReadBias.load()) {
+      S.Owner.store(nullptr, std::memory_order_release);
+      return false;
+    }
+    Held.Locks[Held.Count++] = this;
+    return true;
+  }
+
+  bool releaseFastRead() {
+    auto &Held = fastHeld();
+    for (std::size_t I = 0; I != Held.Count; ++I)
+      if (Held.Locks[I] == this) {
+        Held.Locks[I] = Held.Locks[--Held.Count];
+        slot().Owner.store(nullptr, std::memory_order_release);
+        return true;
+      }
+    return false;
+  }
+
+  void afterSlowRead() {
+    if (!ReadBias.load(std::memory_order_relaxed) &&
+        now() >= InhibitUntil.load(std::memory_order_relaxed))
+      ReadBias.store(true, std::memory_order_release);
+  }
+
+  void revoke() {
+    if (!ReadBias.load(std::memory_order_relaxed))
+      return;
+    ReadBias.store(false);
+    auto Start = now();
+    for (auto &S : Table) {
+      Backoff B;
+      while (S.Owner.load() == this)
+        B.pause();
+    }
+    auto End = now();
+    InhibitUntil.store(End + (End - Start) * InhibitMultiplier,
+                       std::memory_order_relaxed);
+  }
+
+public:
+  BravoLock() = default;
+  BravoLock(const BravoLock &) = delete;
+  BravoLock &operator=(const BravoLock &) = delete;
+
+  void lock() {
+    Underlying.lock();
+    revoke();
+  }
+
+  bool try_lock() {
+    if (!Underlying.try_lock())
+      return false;
+    revoke();
+    return true;
+  }
+
+  void unlock() { Underlying.unlock(); }
+
+  void lock_shared() {
+    if (tryFastRead())
+      return;
+    Underlying.lock_shared();
+    afterSlowRead();
+  }
+
+  bool try_lock_shared() {
+    if (tryFastRead())
+      return true;
+    if (!Underlying.try_lock_shared())
+      return false;
+    afterSlowRead();
+    return true;
+  }
+
+  void unlock_shared() {
+    if (!releaseFastRead())
+      Underlying.unlock_shared();
+  }
+
+  bool read_biased() const { return ReadBias.load(std::memory_order_relaxed); }
+};
+
+using DefaultLockTy = SharedMutexLock;
+} // namespace threadsafe
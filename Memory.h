@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadsafe {
+// Footprint of one container, as returned by memory_usage(). Payload counts
+// the elements themselves, shallowly: a std::string element counts as
+// sizeof(std::string), not its characters. Metadata is everything the
+// container needs besides the elements, such as the object itself, nodes and
+// links, bucket arrays, locks and filters. Wasted is memory held but not in
+// use, such as vector capacity beyond size, spare buckets and erased nodes
+// awaiting reclamation.
+//
+// The split comes from the container's shape and the std library's usual
+// layouts, so it is an estimate. A container whose allocator is a
+// TrackingAllocator reports its exact heap total instead: Metadata absorbs
+// whatever the estimate missed, and Peak is its highest heap footprint.
+struct MemoryUsage {
+  std::size_t Payload = 0;
+  std::size_t Metadata = 0;
+  std::size_t Wasted = 0;
+  // Highest heap footprint seen by the TrackingAllocator; 0 when untracked.
+  std::size_t Peak = 0;
+  bool Tracked = false;
+
+  std::size_t total() const { return Payload + Metadata + Wasted; }
+
+  // Peaks add up to an upper bound: the parts need not peak together.
+  MemoryUsage &operator+=(const MemoryUsage &Other) {
+    Payload += Other.Payload;
+    Metadata += Other.Metadata;
+    Wasted += Other.Wasted;
+    Peak += Other.Peak;
+    Tracked = Tracked && Other.Tracked;
+    return *this;
+  }
+};
+
+// Shared by a TrackingAllocator and all its copies and rebinds.
+struct AllocationCounters {
+  std::atomic<std::size_t> Live{0};
+  std::atomic<std::size_t> Peak{0};
+  std::atomic<std::size_t> Allocations{0};
+
+  void add(std::size_t Bytes) {
+    auto Now = Live.fetch_add(Bytes, std::memory_order_relaxed) + Bytes;
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    auto Old = Peak.load(std::memory_order_relaxed);
+    while (Now > Old &&
+           !Peak.compare_exchange_weak(Old, Now, std::memory_order_relaxed))
+      ;
+  }
+
+  void remove(std::size_t Bytes) {
+    Live.fetch_sub(Bytes, std::memory_order_relaxed);
+  }
+};
+
+// Allocator adaptor that counts the bytes a container holds through
+// Upstream. A default-constructed TrackingAllocator starts its own counters
+// and a container copy gets fresh ones, so each container is accounted for
+// separately. Only share one allocator between containers deliberately.
+template <typename T, typename Upstream = std::allocator<T>>
+class TrackingAllocator {
+  using UpstreamTraits = std::allocator_traits<Upstream>;
+
+  template <typename, typename> friend class TrackingAllocator;
+
+  [[no_unique_address]] Upstream Up;
+  std::shared_ptr<AllocationCounters> Counters;
+
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U> struct rebind {
+    using other =
+        TrackingAllocator<U, typename UpstreamTraits::template rebind_alloc<U>>;
+  };
+
+  TrackingAllocator() : TrackingAllocator(Upstream()) {}
+
+  explicit TrackingAllocator(const Upstream &Up)
+      : Up(Up), Counters(std::make_shared<AllocationCounters>()) {}
+
+  // No move constructor: a moved-from container must keep working counters.
+  TrackingAllocator(const TrackingAllocator &) = default;
+  TrackingAllocator &operator=(const TrackingAllocator &) = default;
+
+  template <typename U, typename UpstreamU>
+  TrackingAllocator(const TrackingAllocator<U, UpstreamU> &Other) noexcept
+      : Up(Other.Up), Counters(Other.Counters) {}
+
+  T *allocate(std::size_t N) {
+    auto *P = UpstreamTraits::allocate(Up, N);
+    Counters->add(N * sizeof(T));
+    return P;
+  }
+
+  void deallocate(T *P, std::size_t N) {
+    Counters->remove(N * sizeof(T));
+    UpstreamTraits::deallocate(Up, P, N);
+  }
+
+  TrackingAllocator select_on_container_copy_construction() const {
+    return TrackingAllocator(
+        UpstreamTraits::select_on_container_copy_construction(Up));
+  }
+
+  const AllocationCounters &counters() const { return *Counters; }
+
+  template <typename U, typename UpstreamU>
+  bool operator==(const TrackingAllocator<U, UpstreamU> &Other) const {
+    return Counters == Other.Counters;
+  }
+};
+
+// Process-wide list of containers that opted in with track_memory().
+class MemoryRegistry {
+public:
+  struct Report {
+    std::string Name;
+    MemoryUsage Usage;
+  };
+
+private:
+  // Callbacks run under the entry's own mutex, never the registry's, so
+  // that a container being registered or destroyed while its owner holds
+  // some other container's lock can't deadlock against a dump that is
+  // waiting for that lock.
+  struct Entry {
+    std::string Name;
+    std::function<MemoryUsage()> Usage;
+    std::mutex Mutex;
+    bool Alive = true;
+
+    Entry(std::string Name, std::function<MemoryUsage()> Usage)
+        : Name(std::move(Name)), Usage(std::move(Usage)) {}
+
+    // Waits for a running callback to finish.
+    void kill() {
+      std::lock_guard Lock(Mutex);
+      Alive = false;
+    }
+  };
+
+  std::mutex Mutex;
+  std::map<const void *, std::shared_ptr<Entry>> Entries;
+
+  MemoryRegistry() = default;
+
+public:
+  // Never destroyed, so containers with static storage duration can still
+  // unregister at exit.
+  static MemoryRegistry &instance() {
+    static auto *Registry = new MemoryRegistry;
+    return *Registry;
+  }
+
+  void add(const void *Owner, std::string Name,
+           std::function<MemoryUsage()> Usage) {
+    auto E = std::make_shared<Entry>(std::move(Name), std::move(Usage));
+    {
+      std::lock_guard Lock(Mutex);
+      std::swap(Entries[Owner], E);
+    }
+    if (E)
+      E->kill();
+  }
+
+  // Once this returns, the owner's callback is not running and won't run.
+  void remove(const void *Owner) {
+    std::shared_ptr<Entry> E;
+    {
+      std::lock_guard Lock(Mutex);
+      auto It = Entries.find(Owner);
+      if (It == Entries.end())
+        return;
+      E = std::move(It->second);
+      Entries.erase(It);
+    }
+    E->kill();
+  }
+
+  // Calls every container's memory_usage(), each under its own lock, with
+  // the registry unlocked.
+  std::vector<Report> collect() {
+    std::vector<std::shared_ptr<Entry>> Live;
+    {
+      std::lock_guard Lock(Mutex);
+      Live.reserve(Entries.size());
+      for (auto &[Owner, E] : Entries)
+        Live.push_back(E);
+    }
+    std::vector<Report> Reports;
+    Reports.reserve(Live.size());
+    for (auto &E : Live) {
+      std::lock_guard Lock(E->Mutex);
+      if (E->Alive)
+        Reports.push_back({E->Name, E->Usage()});
+    }
+    return Reports;
+  }
+
+  MemoryUsage total() {
+    auto Reports = collect();
+    MemoryUsage Total;
+    Total.Tracked = !Reports.empty();
+    for (auto &R : Reports)
+      Total += R.Usage;
+    return Total;
+  }
+
+  void dump(std::FILE *Out = stderr) {
+    auto Reports = collect();
+    std::fprintf(Out, "%-32s %14s %14s %14s %14s %14s\n", "container",
+                 "payload", "metadata", "wasted", "total", "peak");
+    MemoryUsage Total;
+    for (auto &R : Reports) {
+      auto &U = R.Usage;
+      std::fprintf(Out, "%-32s %14zu %14zu %14zu %14zu %14s\n",
+                   R.Name.c_str(), U.Payload, U.Metadata, U.Wasted, U.total(),
+                   U.Tracked ? std::to_string(U.Peak).c_str() : "-");
+      Total += U;
+    }
+    std::fprintf(Out, "%-32s %14zu %14zu %14zu %14zu\n", "(all)",
+                 Total.Payload, Total.Metadata, Total.Wasted, Total.total());
+  }
+};
+
+// A container's entry in the MemoryRegistry, removed on destruction. Copies
+// and moves of a container start out unregistered.
+class MemoryRegistration {
+  const void *Owner = nullptr;
+
+public:
+  MemoryRegistration() = default;
+  MemoryRegistration(const MemoryRegistration &) noexcept {}
+  MemoryRegistration &operator=(const MemoryRegistration &) noexcept {
+    return *this;
+  }
+  ~MemoryRegistration() { reset(); }
+
+  void set(const void *O, std::string Name,
+           std::function<MemoryUsage()> Usage) {
+    MemoryRegistry::instance().add(O, std::move(Name), std::move(Usage));
+    Owner = O;
+  }
+
+  void reset() {
+    if (Owner)
+      MemoryRegistry::instance().remove(std::exchange(Owner, nullptr));
+  }
+};
+
+namespace detail {
+template <typename A> struct IsTrackingAllocator : std::false_type {};
+
+template <typename T, typename U>
+struct IsTrackingAllocator<TrackingAllocator<T, U>> : std::true_type {};
+
+// Completes U, whose Payload and Wasted are filled in, from the heap
+// metadata estimate, or from the exact counts when Alloc is tracking.
+template <typename A>
+void addHeapMetadata(MemoryUsage &U, const A &Alloc, std::size_t Estimate) {
+  if constexpr (IsTrackingAllocator<A>::value) {
+    auto &C = Alloc.counters();
+    auto Live = C.Live.load(std::memory_order_relaxed);
+    U.Metadata += Live - std::min(Live, U.Payload + U.Wasted);
+    U.Peak += C.Peak.load(std::memory_order_relaxed);
+    U.Tracked = true;
+  } else {
+    U.Metadata += Estimate;
+  }
+}
+
+template <typename T, typename A>
+MemoryUsage memoryUsageOf(const std::vector<T, A> &V) {
+  MemoryUsage U;
+  U.Payload = V.size() * sizeof(T);
+  U.Wasted = (V.capacity() - V.size()) * sizeof(T);
+  addHeapMetadata(U, V.get_allocator(), 0);
+  return U;
+}
+
+// std::deque stores elements in fixed-size blocks found through a map of
+// block pointers. 512-byte blocks match libstdc++; libc++ uses 4096.
+template <typename T, typename A>
+MemoryUsage memoryUsageOf(const std::deque<T, A> &D) {
+  constexpr std::size_t PerBlock = sizeof(T) < 512 ? 512 / sizeof(T) : 1;
+  auto Blocks = D.size() / PerBlock + 1;
+  MemoryUsage U;
+  U.Payload = D.size() * sizeof(T);
+  U.Wasted = Blocks * PerBlock * sizeof(T) - U.Payload;
+  addHeapMetadata(U, D.get_allocator(),
+                  std::max<std::size_t>(8, Blocks + 2) * sizeof(void *));
+  return U;
+}
+
+// Any std unordered container. Each element lives in a node with a next
+// pointer and, for most hashers, a cached hash. Buckets beyond what size()
+// needs at max_load_factor() count as wasted.
+template <typename BaseTy> MemoryUsage unorderedMemoryUsage(const BaseTy &C) {
+  auto Buckets = C.bucket_count();
+  auto Needed = std::min<std::size_t>(
+      Buckets, static_cast<std::size_t>(C.size() / C.max_load_factor()) + 1);
+  MemoryUsage U;
+  U.Payload = C.size() * sizeof(typename BaseTy::value_type);
+  U.Wasted = (Buckets - Needed) * sizeof(void *);
+  addHeapMetadata(U, C.get_allocator(),
+                  C.size() * (sizeof(void *) + sizeof(std::size_t)) +
+                      Needed * sizeof(void *));
+  return U;
+}
+} // namespace detail
+} // namespace threadsafe
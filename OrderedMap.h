@@ -0,0 +1,590 @@
+#pragma once
+
+#include "Epoch.h"
+#include "Locks.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+namespace threadsafe {
+// Concurrent ordered map, built as a lazy skip list (Herlihy, Lev, Luchangco
+// and Shavit, "A Simple Optimistic Skiplist Algorithm"). Lookups, range scans
+// and iteration take no locks. Insert and erase lock only the predecessors of
+// the affected node, validate them, and then link or unlink it. Every node
+// carries its own LockTy, which also guards the mapped value for visit() and
+// insert_or_assign().
+//
+// Erased nodes are reclaimed through an EpochDomain. Iterators therefore stay
+// valid while other threads write. They are weakly consistent: a traversal
+// sees every key present for its whole duration, in order and at most once,
+// and may or may not see keys inserted or erased while it runs.
+template <typename Key, typename T, typename Compare = std::less<Key>,
+          typename LockTy = SpinLock>
+class OrderedMap {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using value_type = std::pair<const Key, T>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using key_compare = Compare;
+  using lock_type = LockTy;
+  class iterator;
+  using const_iterator = iterator;
+
+private:
+  static constexpr int MaxHeight = 32;
+
+  struct Node {
+    mutable LockTy Lock;
+    std::atomic<bool> Marked{false};
+    std::atomic<bool> FullyLinked{false};
+    int TopLevel;
+    // Left unconstructed in the head sentinel.
+    union {
+      value_type Value;
+    };
+
+    explicit Node(int Top) : TopLevel(Top) {}
+    ~Node() {}
+
+    // The links for levels 0..TopLevel trail the node in the same allocation.
+    std::atomic<Node *> *next() {
+      return std::launder(reinterpret_cast<std::atomic<Node *> *>(
+          reinterpret_cast<std::byte *>(this) + LinksOffset));
+    }
+
+    const key_type &key() const { return Value.first; }
+  };
+
+  using LinkTy = std::atomic<Node *>;
+  static constexpr std::size_t LinksOffset =
+      (sizeof(Node) + alignof(LinkTy) - 1) / alignof(LinkTy) * alignof(LinkTy);
+  static constexpr std::align_val_t NodeAlign{
+      std::max(alignof(Node), alignof(LinkTy))};
+
+  Node *Head;
+  [[no_unique_address]] Compare Comp;
+  std::atomic<size_type> Count{0};
+  mutable EpochDomain Reclaimer;
+  MemoryRegistration Registration;
+
+  static Node *allocate(int Top) {
+    void *Mem = ::operator new(LinksOffset + (Top + 1) * sizeof(LinkTy),
+                               NodeAlign);
+    auto *N = ::new (Mem) Node(Top);
+    auto *Links = static_cast<std::byte *>(Mem) + LinksOffset;
+    for (int L = 0; L <= Top; ++L)
+      ::new (Links + L * sizeof(LinkTy)) LinkTy(nullptr);
+    return N;
+  }
+
+  static std::size_t nodeBytes(const Node *N) {
+    return LinksOffset + (N->TopLevel + 1) * sizeof(LinkTy);
+  }
+
+  static void deallocate(Node *N) {
+    N->~Node();
+    ::operator delete(static_cast<void *>(N), NodeAlign);
+  }
+
+  static void destroy(void *P) {
+    auto *N = static_cast<Node *>(P);
+    std::destroy_at(&N->Value);
+    deallocate(N);
+  }
+
+  template <typename... Args> static Node *makeNode(Args &&...A) {
+    Node *N = allocate(randomLevel());
+    try {
+      std::construct_at(&N->Value, std::forward<Args>(A)...);
+    } catch (...) {
+      deallocate(N);
+      throw;
+    }
+    return N;
+  }
+
+  // Geometric with p = 1/2, so level L holds about 1/2^L of the nodes.
+  static int randomLevel() {
+    thread_local std::uint64_t State =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    State ^= State << 13;
+    State ^= State >> 7;
+    State ^= State << 17;
+    return std::min(std::countr_one(State), MaxHeight - 1);
+  }
+
+  static bool live(Node *N) {
+    return N->FullyLinked.load(std::memory_order_acquire) &&
+           !N->Marked.load(std::memory_order_acquire);
+  }
+
+  static Node *skipDead(Node *N) {
+    while (N && !live(N))
+      N = N->next()[0].load(std::memory_order_acquire);
+    return N;
+  }
+
+  static Node *nextLive(Node *N) {
+    return skipDead(N->next()[0].load(std::memory_order_acquire));
+  }
+
+  // Fills the predecessors and successors of K at every level and returns the
+  // highest level at which a node with key K was seen, or -1.
+  int findNode(const key_type &K, Node **Preds, Node **Succs) const {
+    int Found = -1;
+    Node *Pred = Head;
+    for (int L = MaxHeight - 1; L >= 0; --L) {
+      Node *Curr = Pred->next()[L].load(std::memory_order_acquire);
+      while (Curr && Comp(Curr->key(), K)) {
+        Pred = Curr;
+        Curr = Pred->next()[L].load(std::memory_order_acquire);
+      }
+      if (Found == -1 && Curr && !Comp(K, Curr->key()))
+        Found = L;
+      Preds[L] = Pred;
+      Succs[L] = Curr;
+    }
+    return Found;
+  }
+
+  // First node, live or not, whose key is not less than K (or, with Upper,
+  // greater than K).
+  Node *seek(const key_type &K, bool Upper) const {
+    Node *Pred = Head;
+    Node *Curr = nullptr;
+    for (int L = MaxHeight - 1; L >= 0; --L) {
+      Curr = Pred->next()[L].load(std::memory_order_acquire);
+      while (Curr && (Upper ? !Comp(K, Curr->key()) : Comp(Curr->key(), K))) {
+        Pred = Curr;
+        Curr = Pred->next()[L].load(std::memory_order_acquire);
+      }
+    }
+    return Curr;
+  }
+
+  Node *findLive(const key_type &K) const {
+    Node *N = seek(K, false);
+    return N && !Comp(K, N->key()) && live(N) ? N : nullptr;
+  }
+
+  // Predecessors at consecutive levels are often the same node; each one is
+  // locked once.
+  static void unlockPreds(Node **Preds, int Highest) {
+    Node *Prev = nullptr;
+    for (int L = 0; L <= Highest; ++L)
+      if (Preds[L] != Prev) {
+        Preds[L]->Lock.unlock();
+        Prev = Preds[L];
+      }
+  }
+
+  // Links a node built by Make() unless a live node with key K exists, in
+  // which case OnFound(Existing.Value, Pending) runs with that node locked.
+  // Pending is the node built on an earlier attempt that lost a race, or null.
+  template <typename MakeFn, typename FoundFn>
+  std::pair<iterator, bool> insertImpl(const key_type &K, MakeFn &&Make,
+                                       FoundFn &&OnFound) {
+    auto Guard = Reclaimer.pin();
+    Node *Preds[MaxHeight];
+    Node *Succs[MaxHeight];
+    Node *Pending = nullptr;
+    struct PendingGuard {
+      Node *&P;
+      ~PendingGuard() {
+        if (P)
+          destroy(P);
+      }
+    } PG{Pending};
+    Backoff B;
+
+    for (;;) {
+      if (int Found = findNode(K, Preds, Succs); Found != -1) {
+        Node *N = Succs[Found];
+        if (!N->Marked.load(std::memory_order_acquire)) {
+          while (!N->FullyLinked.load(std::memory_order_acquire))
+            B.pause();
+          std::lock_guard Lock(N->Lock);
+          if (!N->Marked.load(std::memory_order_relaxed)) {
+            OnFound(N->Value, Pending);
+            return {iterator(std::move(Guard), N), false};
+          }
+        }
+        // Being erased; retry once it's unlinked.
+        B.pause();
+        continue;
+      }
+
+      if (!Pending)
+        Pending = Make();
+      int Top = Pending->TopLevel;
+
+      int Highest = -1;
+      Node *Prev = nullptr;
+      bool Valid = true;
+      for (int L = 0; Valid && L <= Top; ++L) {
+        Node *Pred = Preds[L];
+        Node *Succ = Succs[L];
+        if (Pred != Prev) {
+          Pred->Lock.lock();
+          Highest = L;
+          Prev = Pred;
+        }
+        Valid = !Pred->Marked.load(std::memory_order_acquire) &&
+                (!Succ || !Succ->Marked.load(std::memory_order_acquire)) &&
+                Pred->next()[L].load(std::memory_order_acquire) == Succ;
+      }
+      if (!Valid) {
+        unlockPreds(Preds, Highest);
+        continue;
+      }
+
+      Node *N = std::exchange(Pending, nullptr);
+      for (int L = 0; L <= Top; ++L)
+        N->next()[L].store(Succs[L], std::memory_order_relaxed);
+      for (int L = 0; L <= Top; ++L)
+        Preds[L]->next()[L].store(N, std::memory_order_release);
+      N->FullyLinked.store(true, std::memory_order_release);
+      unlockPreds(Preds, Highest);
+      Count.fetch_add(1, std::memory_order_relaxed);
+      return {iterator(std::move(Guard), N), true};
+    }
+  }
+
+  template <typename F>
+  size_type visitFrom(Node *N, const key_type *Hi, F &Fn) {
+    size_type Visited = 0;
+    for (N = skipDead(N); N && (!Hi || Comp(N->key(), *Hi)); N = nextLive(N)) {
+      std::lock_guard Lock(N->Lock);
+      if (N->Marked.load(std::memory_order_relaxed))
+        continue;
+      std::invoke(Fn, N->Value);
+      ++Visited;
+    }
+    return Visited;
+  }
+
+public:
+  // Forward iterator over a weakly consistent view of the map. It keeps the
+  // map's epoch pinned, so drop iterators promptly under heavy erasure.
+  // Dereferencing copies the entry under its node lock.
+  class iterator {
+    EpochDomain::Guard Guard;
+    Node *Curr = nullptr;
+
+    friend class OrderedMap;
+    iterator(EpochDomain::Guard G, Node *N) : Guard(std::move(G)), Curr(N) {
+      if (!Curr)
+        Guard.reset();
+    }
+
+  public:
+    using iterator_concept = std::input_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = OrderedMap::value_type;
+    using difference_type = std::ptrdiff_t;
+
+    iterator() = default;
+
+    value_type operator*() const {
+      std::lock_guard Lock(Curr->Lock);
+      return Curr->Value;
+    }
+
+    const key_type &key() const { return Curr->key(); }
+
+    iterator &operator++() {
+      Curr = nextLive(Curr);
+      if (!Curr)
+        Guard.reset();
+      return *this;
+    }
+
+    iterator operator++(int) {
+      auto Tmp = *this;
+      ++*this;
+      return Tmp;
+    }
+
+    friend bool operator==(const iterator &A, const iterator &B) {
+      return A.Curr == B.Curr;
+    }
+  };
+
+  OrderedMap() : OrderedMap(Compare()) {}
+
+  explicit OrderedMap(const Compare &C)
+      : Head(allocate(MaxHeight - 1)), Comp(C) {}
+
+  template <typename InputIterator>
+  OrderedMap(InputIterator First, InputIterator Last,
+             const Compare &C = Compare())
+      : OrderedMap(C) {
+    insert(First, Last);
+  }
+
+  OrderedMap(std::initializer_list<value_type> IL, const Compare &C = Compare())
+      : OrderedMap(IL.begin(), IL.end(), C) {}
+
+  // Nodes are shared with concurrent readers, so the map is neither copyable
+  // nor movable.
+  OrderedMap(const OrderedMap &) = delete;
+  OrderedMap &operator=(const OrderedMap &) = delete;
+
+  ~OrderedMap() {
+    Registration.reset();
+    for (Node *N = Head->next()[0].load(std::memory_order_relaxed); N;) {
+      Node *Next = N->next()[0].load(std::memory_order_relaxed);
+      destroy(N);
+      N = Next;
+    }
+    deallocate(Head);
+  }
+
+  key_compare key_comp() const { return Comp; }
+
+  // Exact only when no writer is running.
+  size_type size() const noexcept {
+    return Count.load(std::memory_order_relaxed);
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  // Walks the bottom level without locking, so it costs a traversal and is
+  // exact only when no writer is running. Linked nodes that are erased or
+  // still being inserted count as wasted. So do retired nodes awaiting
+  // reclamation, at the average node size.
+  MemoryUsage memory_usage() const {
+    auto Guard = Reclaimer.pin();
+    MemoryUsage Usage;
+    Usage.Metadata = sizeof(*this) + nodeBytes(Head);
+    std::size_t Nodes = 0, Bytes = 0;
+    for (Node *N = Head->next()[0].load(std::memory_order_acquire); N;
+         N = N->next()[0].load(std::memory_order_acquire)) {
+      auto B = nodeBytes(N);
+      if (live(N)) {
+        Usage.Payload += sizeof(value_type);
+        Usage.Metadata += B - sizeof(value_type);
+      } else {
+        Usage.Wasted += B;
+      }
+      ++Nodes;
+      Bytes += B;
+    }
+    if (Nodes)
+      Usage.Wasted += Reclaimer.pending() * (Bytes / Nodes);
+    return Usage;
+  }
+
+  // Lists this map in the MemoryRegistry under Name until it is destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  iterator begin() const {
+    auto Guard = Reclaimer.pin();
+    Node *N = skipDead(Head->next()[0].load(std::memory_order_acquire));
+    return iterator(std::move(Guard), N);
+  }
+
+  iterator end() const { return iterator(); }
+
+  iterator cbegin() const { return begin(); }
+  iterator cend() const { return end(); }
+
+  std::pair<iterator, bool> insert(const value_type &Obj) {
+    return insertImpl(
+        Obj.first, [&] { return makeNode(Obj); }, [](auto &, Node *) {});
+  }
+
+  std::pair<iterator, bool> insert(value_type &&Obj) {
+    return insertImpl(
+        Obj.first, [&] { return makeNode(std::move(Obj)); },
+        [](auto &, Node *) {});
+  }
+
+  template <typename InputIterator>
+  void insert(InputIterator First, InputIterator Last) {
+    for (; First != Last; ++First)
+      insert(*First);
+  }
+
+  void insert(std::initializer_list<value_type> IL) {
+    insert(IL.begin(), IL.end());
+  }
+
+  // As with std::map, the arguments are left alone if K is already present
+  // when the call starts; a racing insert of K may still win after they have
+  // been consumed.
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(const key_type &K, Args &&...A) {
+    return insertImpl(
+        K,
+        [&] {
+          return makeNode(std::piecewise_construct, std::forward_as_tuple(K),
+                          std::forward_as_tuple(std::forward<Args>(A)...));
+        },
+        [](auto &, Node *) {});
+  }
+
+  template <typename M>
+  std::pair<iterator, bool> insert_or_assign(const key_type &K, M &&Obj) {
+    return insertImpl(
+        K, [&] { return makeNode(K, std::forward<M>(Obj)); },
+        [&](value_type &Existing, Node *Pending) {
+          if (Pending)
+            Existing.second = std::move(Pending->Value.second);
+          else
+            Existing.second = std::forward<M>(Obj);
+        });
+  }
+
+  size_type erase(const key_type &K) {
+    auto Guard = Reclaimer.pin();
+    Node *Preds[MaxHeight];
+    Node *Succs[MaxHeight];
+    Node *Victim = nullptr;
+    int Top = -1;
+
+    for (;;) {
+      int Found = findNode(K, Preds, Succs);
+      if (!Victim) {
+        if (Found == -1)
+          return 0;
+        Node *N = Succs[Found];
+        // A node seen below its top level is still being linked (or already
+        // being unlinked), so it isn't logically present.
+        if (!N->FullyLinked.load(std::memory_order_acquire) ||
+            N->TopLevel != Found || N->Marked.load(std::memory_order_acquire))
+          return 0;
+        N->Lock.lock();
+        if (N->Marked.load(std::memory_order_relaxed)) {
+          N->Lock.unlock();
+          return 0;
+        }
+        N->Marked.store(true, std::memory_order_release);
+        Victim = N;
+        Top = N->TopLevel;
+      }
+
+      int Highest = -1;
+      Node *Prev = nullptr;
+      bool Valid = true;
+      for (int L = 0; Valid && L <= Top; ++L) {
+        Node *Pred = Preds[L];
+        if (Pred != Prev) {
+          Pred->Lock.lock();
+          Highest = L;
+          Prev = Pred;
+        }
+        Valid = !Pred->Marked.load(std::memory_order_acquire) &&
+                Pred->next()[L].load(std::memory_order_acquire) == Victim;
+      }
+      if (!Valid) {
+        unlockPreds(Preds, Highest);
+        continue;
+      }
+
+      for (int L = Top; L >= 0; --L)
+        Preds[L]->next()[L].store(
+            Victim->next()[L].load(std::memory_order_relaxed),
+            std::memory_order_release);
+      Victim->Lock.unlock();
+      unlockPreds(Preds, Highest);
+      Count.fetch_sub(1, std::memory_order_relaxed);
+      Reclaimer.retire(Victim, &destroy);
+      return 1;
+    }
+  }
+
+  // Erases every key present when the call starts; keys inserted meanwhile
+  // may survive.
+  void clear() {
+    auto Guard = Reclaimer.pin();
+    for (Node *N = skipDead(Head->next()[0].load(std::memory_order_acquire));
+         N; N = nextLive(N))
+      erase(N->key());
+  }
+
+  iterator find(const key_type &K) const {
+    auto Guard = Reclaimer.pin();
+    return iterator(std::move(Guard), findLive(K));
+  }
+
+  bool contains(const key_type &K) const {
+    auto Guard = Reclaimer.pin();
+    return findLive(K) != nullptr;
+  }
+
+  size_type count(const key_type &K) const { return contains(K); }
+
+  iterator lower_bound(const key_type &K) const {
+    auto Guard = Reclaimer.pin();
+    return iterator(std::move(Guard), skipDead(seek(K, false)));
+  }
+
+  iterator upper_bound(const key_type &K) const {
+    auto Guard = Reclaimer.pin();
+    return iterator(std::move(Guard), skipDead(seek(K, true)));
+  }
+
+  // Calls Fn(value_type &) on the entry for K with its node locked. Returns
+  // false if K is absent. Fn must not call back into the map.
+  template <typename F> bool visit(const key_type &K, F &&Fn) {
+    auto Guard = Reclaimer.pin();
+    Node *N = findLive(K);
+    if (!N)
+      return false;
+    std::lock_guard Lock(N->Lock);
+    if (N->Marked.load(std::memory_order_relaxed))
+      return false;
+    std::invoke(Fn, N->Value);
+    return true;
+  }
+
+  template <typename F> bool visit(const key_type &K, F &&Fn) const {
+    return const_cast<OrderedMap *>(this)->visit(
+        K, [&](value_type &V) { std::invoke(Fn, std::as_const(V)); });
+  }
+
+  // Calls Fn on every entry with Lo <= key < Hi, in key order, each with its
+  // node locked. Returns the number of entries visited.
+  template <typename F>
+  size_type range(const key_type &Lo, const key_type &Hi, F &&Fn) {
+    auto Guard = Reclaimer.pin();
+    return visitFrom(seek(Lo, false), &Hi, Fn);
+  }
+
+  template <typename F>
+  size_type range(const key_type &Lo, const key_type &Hi, F &&Fn) const {
+    return const_cast<OrderedMap *>(this)->range(
+        Lo, Hi, [&](value_type &V) { std::invoke(Fn, std::as_const(V)); });
+  }
+
+  template <typename F> size_type visit_all(F &&Fn) {
+    auto Guard = Reclaimer.pin();
+    return visitFrom(Head->next()[0].load(std::memory_order_acquire), nullptr,
+                     Fn);
+  }
+
+  template <typename F> size_type visit_all(F &&Fn) const {
+    return const_cast<OrderedMap *>(this)->visit_all(
+        [&](value_type &V) { std::invoke(Fn, std::as_const(V)); });
+  }
+};
+} // namespace threadsafe
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "Memory.h"
+#include "Types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#endif
+#endif
+
+namespace threadsafe {
+// The CPU the calling thread is running on, or a stable per-thread stand-in
+// where the platform can't tell. The thread may migrate right after the call,
+// so the answer is only a locality hint, never proof of exclusive access.
+//
+// With glibc 2.35 or later every thread is registered for restartable
+// sequences, and the kernel keeps the current CPU in the thread's rseq area.
+// Reading it is a plain load, where sched_getcpu() may be a vDSO call or a
+// full system call.
+inline unsigned currentCpu() {
+#if defined(__linux__) && defined(RSEQ_SIG) &&                                 \
+    (defined(__x86_64__) || defined(__aarch64__))
+  if (__rseq_size != 0) {
+    auto *Area = reinterpret_cast<const struct rseq *>(
+        static_cast<const char *>(__builtin_thread_pointer()) + __rseq_offset);
+    auto Cpu = __atomic_load_n(&Area->cpu_id, __ATOMIC_RELAXED);
+    if (static_cast<std::int32_t>(Cpu) >= 0)
+      return Cpu;
+  }
+#endif
+#ifdef __linux__
+  if (int Cpu = sched_getcpu(); Cpu >= 0)
+    return static_cast<unsigned>(Cpu);
+#endif
+  return static_cast<unsigned>(threadHash());
+}
+
+// Number of CPU ids currentCpu() can return, counting offline CPUs, which may
+// come online later.
+inline unsigned cpuCount() {
+#ifdef __linux__
+  if (long N = sysconf(_SC_NPROCESSORS_CONF); N > 0)
+    return static_cast<unsigned>(N);
+#endif
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+namespace detail {
+// The engine behind ShardedQueue and ShardedVector: one BaseTy per CPU, each
+// behind its own lock and on its own cache lines. Operations go to the
+// calling CPU's shard, where the lock is uncontended unless a thread migrated
+// mid-operation or a consumer from another CPU is stealing, so the common case
+// touches no line that another core is writing. Consumers whose shard is empty
+// steal from the others in CPU order.
+template <typename BaseTy, typename LockTy> class PerCpuShards {
+protected:
+  struct alignas(CacheLineSize) Shard {
+    LockTy Mutex;
+    BaseTy Elements;
+    // Elements.size(), kept up to date under Mutex so that size() and thieves
+    // can look at a shard without locking it.
+    std::atomic<std::size_t> Count{0};
+  };
+
+  std::unique_ptr<Shard[]> Shards;
+  std::size_t NumShards;
+  // Consumers about to sleep. Producers only read it, so it stays shared in
+  // their caches until someone actually waits.
+  alignas(CacheLineSize) std::atomic<std::size_t> Sleepers{0};
+  alignas(CacheLineSize) std::atomic<std::uint32_t> Signal{0};
+  // Last, so it unregisters before anything memory_usage() reads is gone.
+  MemoryRegistration Registration;
+
+  explicit PerCpuShards(std::size_t N)
+      : Shards(std::make_unique<Shard[]>(std::max<std::size_t>(1, N))),
+        NumShards(std::max<std::size_t>(1, N)) {}
+
+  std::size_t home() const { return currentCpu() % NumShards; }
+
+  // Runs Fn on the calling CPU's shard and wakes a sleeping consumer if
+  // there is one, or all of them if Fn added several elements.
+  template <typename Fn> void insert(Fn &&F, bool WakeAll = false) {
+    auto &S = Shards[home()];
+    {
+      std::lock_guard Lock(S.Mutex);
+      F(S.Elements);
+      // Sequentially consistent so that, against the Sleepers increment in
+      // waitAndTake(), either the sleeper sees the element or we see it.
+      S.Count.store(S.Elements.size());
+    }
+    if (Sleepers.load() == 0)
+      return;
+    Signal.fetch_add(1, std::memory_order_release);
+    if (WakeAll)
+      Signal.notify_all();
+    else
+      Signal.notify_one();
+  }
+
+  // Runs Fn on the first non-empty shard, starting with the calling CPU's.
+  template <typename Fn>
+  bool take(Fn &&F, std::memory_order Order = std::memory_order_relaxed) {
+    auto Home = home();
+    for (std::size_t I = 0; I != NumShards; ++I) {
+      auto &S = Shards[(Home + I) % NumShards];
+      if (S.Count.load(Order) == 0)
+        continue;
+      std::lock_guard Lock(S.Mutex);
+      if (S.Elements.empty())
+        continue;
+      F(S.Elements);
+      S.Count.store(S.Elements.size(), std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  template <typename Fn> void waitAndTake(Fn &&F) {
+    for (;;) {
+      if (take(F))
+        return;
+      Sleepers.fetch_add(1);
+      auto Seen = Signal.load(std::memory_order_acquire);
+      bool Taken = take(F, std::memory_order_seq_cst);
+      if (!Taken)
+        Signal.wait(Seen, std::memory_order_acquire);
+      Sleepers.fetch_sub(1, std::memory_order_relaxed);
+      if (Taken)
+        return;
+    }
+  }
+
+public:
+  using size_type = std::size_t;
+
+  PerCpuShards(const PerCpuShards &) = delete;
+  PerCpuShards &operator=(const PerCpuShards &) = delete;
+
+  // Exact only while no one is pushing or popping.
+  size_type size() const {
+    size_type N = 0;
+    for (std::size_t I = 0; I != NumShards; ++I)
+      N += Shards[I].Count.load(std::memory_order_relaxed);
+    return N;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_type shard_count() const { return NumShards; }
+
+  // Locks one shard at a time. Padding shards to cache lines shows up as
+  // metadata, which helps when picking a shard count.
+  MemoryUsage memory_usage() const {
+    MemoryUsage Usage;
+    Usage.Tracked = true;
+    for (std::size_t I = 0; I != NumShards; ++I) {
+      std::lock_guard Lock(Shards[I].Mutex);
+      Usage += detail::memoryUsageOf(Shards[I].Elements);
+    }
+    Usage.Metadata += sizeof(*this) + NumShards * sizeof(Shard);
+    return Usage;
+  }
+
+  // Lists this container in the MemoryRegistry under Name until it is
+  // destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  void clear() {
+    for (std::size_t I = 0; I != NumShards; ++I) {
+      std::lock_guard Lock(Shards[I].Mutex);
+      Shards[I].Elements.clear();
+      Shards[I].Count.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+} // namespace detail
+} // namespace threadsafe
@@ -0,0 +1,216 @@
+#pragma once
+
+#include "Locks.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace threadsafe {
+inline constexpr struct StrictOrderTy {
+} StrictOrder;
+
+// Relaxed concurrent priority queue in the MultiQueue style (Rihani, Sanders
+// and Dementiev). Elements are spread over Factor * NumThreads independently
+// locked heaps; push goes to a random heap and pop takes the better top of two
+// randomly chosen heaps. With a single heap (StrictOrder) it degrades to an
+// exact, globally locked priority queue.
+template <typename T, typename Compare = std::less<T>,
+          typename LockTy = std::mutex>
+class PriorityQueue {
+  struct alignas(CacheLineSize) Heap {
+    LockTy Mutex;
+    std::vector<T> Elements;
+  };
+
+  std::unique_ptr<Heap[]> Heaps;
+  std::size_t NumHeaps;
+  [[no_unique_address]] Compare Comp;
+  alignas(CacheLineSize) std::atomic<std::size_t> Size{0};
+  // Last, so it unregisters before anything memory_usage() reads is gone.
+  MemoryRegistration Registration;
+
+  static constexpr unsigned MaxAttempts = 8;
+
+  static std::uint64_t nextRandom() {
+    thread_local std::uint64_t Seed =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 7;
+    Seed ^= Seed << 17;
+    return Seed;
+  }
+
+  void pushLocked(Heap &H, T &&Value) {
+    H.Elements.push_back(std::move(Value));
+    std::push_heap(H.Elements.begin(), H.Elements.end(), Comp);
+  }
+
+  T popLocked(Heap &H) {
+    std::pop_heap(H.Elements.begin(), H.Elements.end(), Comp);
+    T Value = std::move(H.Elements.back());
+    H.Elements.pop_back();
+    return Value;
+  }
+
+  void publish() {
+    if (Size.fetch_add(1, std::memory_order_release) == 0)
+      Size.notify_all();
+  }
+
+  bool tryPopRelaxed(T &Value) {
+    for (unsigned Attempt = 0;
+         Attempt != MaxAttempts && Size.load(std::memory_order_relaxed) != 0;
+         ++Attempt) {
+      auto I = nextRandom() % NumHeaps;
+      auto J = nextRandom() % (NumHeaps - 1);
+      if (J >= I)
+        ++J;
+
+      std::unique_lock LockI(Heaps[I].Mutex, std::try_to_lock);
+      if (!LockI)
+        continue;
+      std::unique_lock LockJ(Heaps[J].Mutex, std::try_to_lock);
+
+      Heap *Best = Heaps[I].Elements.empty() ? nullptr : &Heaps[I];
+      if (LockJ && !Heaps[J].Elements.empty() &&
+          (!Best ||
+           Comp(Best->Elements.front(), Heaps[J].Elements.front())))
+        Best = &Heaps[J];
+      if (!Best)
+        continue;
+
+      Value = popLocked(*Best);
+      return true;
+    }
+    return false;
+  }
+
+  bool tryPopSweep(T &Value) {
+    auto Start = nextRandom() % NumHeaps;
+    for (std::size_t K = 0; K != NumHeaps; ++K) {
+      auto &H = Heaps[(Start + K) % NumHeaps];
+      std::lock_guard Lock(H.Mutex);
+      if (!H.Elements.empty()) {
+        Value = popLocked(H);
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using value_compare = Compare;
+
+  static constexpr std::size_t DefaultFactor = 2;
+
+  explicit PriorityQueue(
+      std::size_t Factor = DefaultFactor,
+      std::size_t NumThreads = std::max(1u, std::thread::hardware_concurrency()),
+      const Compare &Comp = Compare())
+      : NumHeaps(std::max<std::size_t>(1, Factor * NumThreads)), Comp(Comp) {
+    Heaps = std::make_unique<Heap[]>(NumHeaps);
+  }
+
+  explicit PriorityQueue(StrictOrderTy, const Compare &Comp = Compare())
+      : PriorityQueue(1, 1, Comp) {}
+
+  PriorityQueue(const PriorityQueue &) = delete;
+  PriorityQueue &operator=(const PriorityQueue &) = delete;
+
+  size_type size() const { return Size.load(std::memory_order_relaxed); }
+
+  bool empty() const { return size() == 0; }
+
+  size_type heap_count() const { return NumHeaps; }
+
+  // Locks one heap at a time.
+  MemoryUsage memory_usage() const {
+    MemoryUsage Usage;
+    for (std::size_t I = 0; I != NumHeaps; ++I) {
+      std::lock_guard Lock(Heaps[I].Mutex);
+      Usage += detail::memoryUsageOf(Heaps[I].Elements);
+    }
+    Usage.Metadata += sizeof(*this) + NumHeaps * sizeof(Heap);
+    return Usage;
+  }
+
+  // Lists this queue in the MemoryRegistry under Name until it is destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  bool strict() const { return NumHeaps == 1; }
+
+  void push(const T &Value) { emplace(Value); }
+
+  void push(T &&Value) { emplace(std::move(Value)); }
+
+  template <typename... ArgsTy> void emplace(ArgsTy &&...Args) {
+    T Value(std::forward<ArgsTy>(Args)...);
+    if (NumHeaps == 1) {
+      std::lock_guard Lock(Heaps[0].Mutex);
+      pushLocked(Heaps[0], std::move(Value));
+      publish();
+      return;
+    }
+
+    for (;;) {
+      auto &H = Heaps[nextRandom() % NumHeaps];
+      std::unique_lock Lock(H.Mutex, std::try_to_lock);
+      if (!Lock)
+        continue;
+      pushLocked(H, std::move(Value));
+      publish();
+      return;
+    }
+  }
+
+  bool try_pop(T &Value) {
+    if (NumHeaps == 1) {
+      std::lock_guard Lock(Heaps[0].Mutex);
+      if (Heaps[0].Elements.empty())
+        return false;
+      Value = popLocked(Heaps[0]);
+      Size.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    if (!tryPopRelaxed(Value) &&
+        (Size.load(std::memory_order_relaxed) == 0 || !tryPopSweep(Value)))
+      return false;
+    Size.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  std::shared_ptr<T> try_pop() {
+    T Value;
+    if (!try_pop(Value))
+      return nullptr;
+    return std::make_shared<T>(std::move(Value));
+  }
+
+  void wait_and_pop(T &Value) {
+    for (;;) {
+      if (try_pop(Value))
+        return;
+      Size.wait(0, std::memory_order_acquire);
+    }
+  }
+
+  std::shared_ptr<T> wait_and_pop() {
+    T Value;
+    wait_and_pop(Value);
+    return std::make_shared<T>(std::move(Value));
+  }
+};
+} // namespace threadsafe
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Atomically.h"
+#include "Locks.h"
+#include "Memory.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <string>
+
+namespace threadsafe {
+template <typename T, typename Allocator = std::allocator<T>,
+          typename LockTy = DefaultLockTy>
+class Queue {
+  using ReadLockTy = std::shared_lock<LockTy>;
+  using WriteLockTy = std::unique_lock<LockTy>;
+  using BaseTy = std::queue<T, std::deque<T, Allocator>>;
+
+  // Exposes the underlying deque to memory_usage().
+  struct Storage : BaseTy {
+    using BaseTy::c;
+  };
+
+  Storage TheQueue;
+  std::condition_variable_any CV;
+  mutable LockTy TheMutex;
+  // Last, so it unregisters before anything memory_usage() reads is gone.
+  MemoryRegistration Registration;
+
+  friend struct ContainerAccess;
+
+  BaseTy &raw() { return TheQueue; }
+  void notifyAll() { CV.notify_all(); }
+
+public:
+  using value_type = T;
+  using allocator_type = Allocator;
+  using lock_type = LockTy;
+
+  Queue() = default;
+  Queue(const Queue &Other) {
+    ReadLockTy Lock(Other.TheMutex);
+    TheQueue = Other.TheQueue;
+  }
+
+  auto size() const {
+    ReadLockTy Lock(TheMutex);
+    return std::size(TheQueue);
+  }
+
+  bool empty() const {
+    ReadLockTy Lock(TheMutex);
+    return std::empty(TheQueue);
+  }
+
+  MemoryUsage memory_usage() const {
+    ReadLockTy Lock(TheMutex);
+    auto Usage = detail::memoryUsageOf(TheQueue.c);
+    Usage.Metadata += sizeof(*this);
+    return Usage;
+  }
+
+  // Lists this Queue in the MemoryRegistry under Name until it is destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  void push(const T &Value) {
+    std::lock_guard Lock(TheMutex);
+    TheQueue.push(Value);
+    CV.notify_one();
+  }
+
+  void push(T &&Value) {
+    std::lock_guard Lock(TheMutex);
+    TheQueue.push(std::move(Value));
+    CV.notify_one();
+  }
+
+  void wait_and_pop(T &Value) {
+    WriteLockTy Lock(TheMutex);
+    CV.wait(Lock, [this] { return !std::empty(TheQueue); });
+    Value = std::move(TheQueue.front());
+    TheQueue.pop();
+  }
+
+  std::shared_ptr<T> wait_and_pop() {
+    WriteLockTy Lock(TheMutex);
+    CV.wait(Lock, [this] { return !std::empty(TheQueue); });
+    auto Value = std::make_shared<T>(std::move(TheQueue.front()));
+    TheQueue.pop();
+    return Value;
+  }
+
+  bool try_pop(T &Value) {
+    std::lock_guard Lock(TheMutex);
+    if (std::empty(TheQueue))
+      return false;
+    Value = std::move(TheQueue.front());
+    TheQueue.pop();
+    return true;
+  }
+
+  std::shared_ptr<T> try_pop() {
+    std::lock_guard Lock(TheMutex);
+    if (std::empty(TheQueue))
+      return nullptr;
+    auto Value = std::make_shared<T>(std::move(TheQueue.front()));
+    TheQueue.pop();
+    return Value;
+  }
+};
+} // namespace threadsafe
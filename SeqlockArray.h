@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Locks.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace threadsafe {
+// Fixed-size array for read-mostly data guarded by a sequence lock. Readers
+// copy optimistically and retry if a writer ran concurrently, so the read path
+// performs only loads. Writers are serialized by a mutex and bump the sequence
+// counter to odd while they modify the payload.
+//
+// The payload is kept in relaxed atomic words rather than raw T so that the
+// racy reads of a retried copy are not undefined behaviour.
+template <typename T, std::size_t N, typename LockTy = std::mutex>
+class SeqlockArray {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  using WordTy = std::uint64_t;
+  static constexpr std::size_t ElemWords =
+      (sizeof(T) + sizeof(WordTy) - 1) / sizeof(WordTy);
+  static constexpr std::size_t NumWords = ElemWords * N;
+
+  alignas(CacheLineSize) std::atomic<std::uint64_t> Seq{0};
+  LockTy WriteMutex;
+  alignas(CacheLineSize) std::array<std::atomic<WordTy>, NumWords> Words{};
+
+  void readElem(std::size_t I, T &Out) const {
+    WordTy Buf[ElemWords];
+    for (std::size_t W = 0; W != ElemWords; ++W)
+      Buf[W] = Words[I * ElemWords + W].load(std::memory_order_relaxed);
+    std::memcpy(&Out, Buf, sizeof(T));
+  }
+
+  void writeElem(std::size_t I, const T &Value) {
+    WordTy Buf[ElemWords] = {};
+    std::memcpy(Buf, &Value, sizeof(T));
+    for (std::size_t W = 0; W != ElemWords; ++W)
+      Words[I * ElemWords + W].store(Buf[W], std::memory_order_relaxed);
+  }
+
+  template <typename F> void read(F &&Copy) const {
+    Backoff B;
+    for (;;) {
+      auto S1 = Seq.load(std::memory_order_acquire);
+      if (S1 & 1) {
+        B.pause();
+        continue;
+      }
+      Copy();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (Seq.load(std::memory_order_relaxed) == S1)
+        return;
+    }
+  }
+
+  template <typename F> void write(F &&Modify) {
+    std::lock_guard Lock(WriteMutex);
+    auto S = Seq.load(std::memory_order_relaxed);
+    Seq.store(S + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    Modify();
+    Seq.store(S + 2, std::memory_order_release);
+  }
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+
+  SeqlockArray() {
+    for (size_type I = 0; I != N; ++I)
+      writeElem(I, T());
+  }
+
+  explicit SeqlockArray(const std::array<T, N> &Init) {
+    for (size_type I = 0; I != N; ++I)
+      writeElem(I, Init[I]);
+  }
+
+  SeqlockArray(const SeqlockArray &) = delete;
+  SeqlockArray &operator=(const SeqlockArray &) = delete;
+
+  constexpr size_type size() const noexcept { return N; }
+
+  constexpr bool empty() const noexcept { return N == 0; }
+
+  // Consistent copy of the whole array.
+  std::array<T, N> snapshot() const {
+    std::array<T, N> Out;
+    read([&] {
+      for (size_type I = 0; I != N; ++I)
+        readElem(I, Out[I]);
+    });
+    return Out;
+  }
+
+  // Consistent copy of a single element.
+  T load(size_type I) const {
+    T Out;
+    read([&] { readElem(I, Out); });
+    return Out;
+  }
+
+  T operator[](size_type I) const { return load(I); }
+
+  // Number of completed writes; useful to skip re-reading unchanged data.
+  std::uint64_t version() const {
+    return Seq.load(std::memory_order_acquire) / 2;
+  }
+
+  void store(size_type I, const T &Value) {
+    write([&] { writeElem(I, Value); });
+  }
+
+  void store(const std::array<T, N> &Values) {
+    write([&] {
+      for (size_type I = 0; I != N; ++I)
+        writeElem(I, Values[I]);
+    });
+  }
+
+  void fill(const T &Value) {
+    write([&] {
+      for (size_type I = 0; I != N; ++I)
+        writeElem(I, Value);
+    });
+  }
+
+  // Applies Fn to element I in place under the write side of the lock.
+  template <typename F> void update(size_type I, F &&Fn) {
+    write([&] {
+      T Value;
+      readElem(I, Value);
+      Fn(Value);
+      writeElem(I, Value);
+    });
+  }
+
+  // Applies Fn to a copy of the whole array and publishes the result.
+  template <typename F> void update(F &&Fn) {
+    write([&] {
+      std::array<T, N> Values;
+      for (size_type I = 0; I != N; ++I)
+        readElem(I, Values[I]);
+      Fn(Values);
+      for (size_type I = 0; I != N; ++I)
+        writeElem(I, Values[I]);
+    });
+  }
+};
+
+// Single value published through a sequence lock.
+template <typename T, typename LockTy = std::mutex> class SeqlockValue {
+  SeqlockArray<T, 1, LockTy> Storage;
+
+public:
+  using value_type = T;
+
+  SeqlockValue() = default;
+  explicit SeqlockValue(const T &Init) : Storage({Init}) {}
+
+  T load() const { return Storage.load(0); }
+
+  T snapshot() const { return Storage.load(0); }
+
+  void store(const T &Value) { Storage.store(0, Value); }
+
+  template <typename F> void update(F &&Fn) {
+    Storage.update(0, std::forward<F>(Fn));
+  }
+
+  std::uint64_t version() const { return Storage.version(); }
+};
+} // namespace threadsafe
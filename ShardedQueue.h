@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Locks.h"
+#include "PerCpu.h"
+
+#include <deque>
+#include <memory>
+#include <utility>
+
+namespace threadsafe {
+// A FIFO queue per CPU (see PerCpu.h). Elements come out in push order
+// relative to others pushed on the same CPU; there is no order across CPUs.
+// A consumer pops from its own CPU's queue and steals from the others when
+// that one is empty.
+template <typename T, typename LockTy = SpinLock>
+class ShardedQueue : public detail::PerCpuShards<std::deque<T>, LockTy> {
+  using Base = detail::PerCpuShards<std::deque<T>, LockTy>;
+
+  static void popFront(std::deque<T> &Q, T &Value) {
+    Value = std::move(Q.front());
+    Q.pop_front();
+  }
+
+public:
+  using value_type = T;
+  using lock_type = LockTy;
+
+  explicit ShardedQueue(std::size_t NumShards = cpuCount())
+      : Base(NumShards) {}
+
+  void push(const T &Value) { emplace(Value); }
+
+  void push(T &&Value) { emplace(std::move(Value)); }
+
+  template <typename... ArgsTy> void emplace(ArgsTy &&...Args) {
+    this->insert([&](std::deque<T> &Q) {
+      Q.emplace_back(std::forward<ArgsTy>(Args)...);
+    });
+  }
+
+  bool try_pop(T &Value) {
+    return this->take([&](std::deque<T> &Q) { popFront(Q, Value); });
+  }
+
+  std::shared_ptr<T> try_pop() {
+    std::shared_ptr<T> Value;
+    this->take([&](std::deque<T> &Q) {
+      Value = std::make_shared<T>(std::move(Q.front()));
+      Q.pop_front();
+    });
+    return Value;
+  }
+
+  void wait_and_pop(T &Value) {
+    this->waitAndTake([&](std::deque<T> &Q) { popFront(Q, Value); });
+  }
+
+  std::shared_ptr<T> wait_and_pop() {
+    std::shared_ptr<T> Value;
+    this->waitAndTake([&](std::deque<T> &Q) {
+      Value = std::make_shared<T>(std::move(Q.front()));
+      Q.pop_front();
+    });
+    return Value;
+  }
+};
+} // namespace threadsafe
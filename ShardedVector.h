@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Locks.h"
+#include "PerCpu.h"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadsafe {
+// A vector per CPU (see PerCpu.h), used as an unordered bag: pop_back takes
+// the most recent element pushed on the calling CPU, which is the one most
+// likely still in its cache, and steals from the other CPUs when there is
+// none.
+template <typename T, typename Allocator = std::allocator<T>,
+          typename LockTy = SpinLock>
+class ShardedVector
+    : public detail::PerCpuShards<std::vector<T, Allocator>, LockTy> {
+  using BaseTy = std::vector<T, Allocator>;
+  using Base = detail::PerCpuShards<BaseTy, LockTy>;
+
+  static void popBack(BaseTy &V, T &Value) {
+    if constexpr (std::is_move_assignable_v<T>)
+      Value = std::move(V.back());
+    else
+      Value = V.back();
+    V.pop_back();
+  }
+
+public:
+  using value_type = T;
+  using allocator_type = Allocator;
+  using reference = T &;
+  using const_reference = const T &;
+  using lock_type = LockTy;
+
+  explicit ShardedVector(std::size_t NumShards = cpuCount())
+      : Base(NumShards) {}
+
+  // Reserves Capacity elements in every shard.
+  void reserve(std::size_t Capacity) {
+    for (std::size_t I = 0; I != this->NumShards; ++I) {
+      std::lock_guard Lock(this->Shards[I].Mutex);
+      this->Shards[I].Elements.reserve(Capacity);
+    }
+  }
+
+  void push_back(const T &Value) { emplace_back(Value); }
+
+  void push_back(T &&Value) { emplace_back(std::move(Value)); }
+
+  template <typename... ArgsTy> void push(ArgsTy &&...Args) {
+    this->insert(
+        [&](BaseTy &V) { (V.push_back(std::forward<ArgsTy>(Args)), ...); },
+        sizeof...(ArgsTy) > 1);
+  }
+
+  template <typename... ArgsTy> void emplace_back(ArgsTy &&...Args) {
+    this->insert(
+        [&](BaseTy &V) { V.emplace_back(std::forward<ArgsTy>(Args)...); });
+  }
+
+  bool try_pop_back(reference Value) {
+    return this->take([&](BaseTy &V) { popBack(V, Value); });
+  }
+
+  std::unique_ptr<value_type> try_pop_back() {
+    std::unique_ptr<value_type> Value;
+    this->take([&](BaseTy &V) {
+      Value = std::make_unique<value_type>(std::move_if_noexcept(V.back()));
+      V.pop_back();
+    });
+    return Value;
+  }
+
+  void wait_and_pop_back(reference Value) {
+    this->waitAndTake([&](BaseTy &V) { popBack(V, Value); });
+  }
+
+  // Pops up to Count elements into Value, from the calling CPU's shard first
+  // and then from the others, and returns how many it got.
+  std::size_t try_pop(std::size_t Count, BaseTy &Value) {
+    Value.clear();
+    while (Value.size() < Count &&
+           this->take([&](BaseTy &V) {
+             auto N = std::min(Count - Value.size(), V.size());
+             std::move(V.end() - N, V.end(), std::back_inserter(Value));
+             V.resize(V.size() - N);
+           }))
+      ;
+    return Value.size();
+  }
+};
+} // namespace threadsafe
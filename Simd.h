@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Bulk kernels over contiguous arithmetic data. The vector width is picked at
+// compile time from the target flags (-mavx512f, -mavx2, ...) and the kernels
+// are written with GCC/Clang vector extensions, so the same source lowers to
+// AVX-512, AVX2 or SSE/NEON. Other compilers and non-vectorizable element types
+// use the scalar loops.
+namespace threadsafe::simd {
+#if defined(__AVX512F__)
+inline constexpr std::size_t VectorBytes = 64;
+#elif defined(__AVX2__) || defined(__AVX__)
+inline constexpr std::size_t VectorBytes = 32;
+#else
+inline constexpr std::size_t VectorBytes = 16;
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADSAFE_HAS_VECTOR_EXT 1
+#else
+#define THREADSAFE_HAS_VECTOR_EXT 0
+#endif
+
+template <typename T>
+inline constexpr bool IsVectorizable =
+    THREADSAFE_HAS_VECTOR_EXT && std::is_arithmetic_v<T> &&
+    !std::is_same_v<T, bool> && sizeof(T) <= 8 && sizeof(T) < VectorBytes &&
+    !std::is_same_v<T, long double>;
+
+#if THREADSAFE_HAS_VECTOR_EXT
+namespace detail {
+template <std::size_t Size> struct MaskElem;
+template <> struct MaskElem<1> { using Type = std::int8_t; };
+template <> struct MaskElem<2> { using Type = std::int16_t; };
+template <> struct MaskElem<4> { using Type = std::int32_t; };
+template <> struct MaskElem<8> { using Type = std::int64_t; };
+
+template <typename T> struct Vec {
+  typedef T Type __attribute__((vector_size(VectorBytes)));
+  typedef typename MaskElem<sizeof(T)>::Type MaskTy
+      __attribute__((vector_size(VectorBytes)));
+  typedef std::uint64_t WordsTy __attribute__((vector_size(VectorBytes)));
+  static constexpr std::size_t Lanes = VectorBytes / sizeof(T);
+
+  static Type load(const T *P) {
+    Type V;
+    std::memcpy(&V, P, sizeof(V));
+    return V;
+  }
+
+  static void store(T *P, Type V) { std::memcpy(P, &V, sizeof(V)); }
+
+  static Type splat(T X) {
+    Type V;
+    for (std::size_t L = 0; L != Lanes; ++L)
+      V[L] = X;
+    return V;
+  }
+
+  static bool any(MaskTy M) {
+    auto W = (WordsTy)M;
+    std::uint64_t Acc = 0;
+    for (std::size_t L = 0; L != VectorBytes / 8; ++L)
+      Acc |= W[L];
+    return Acc != 0;
+  }
+};
+} // namespace detail
+#endif
+
+template <typename T> T sum(const T *P, std::size_t N) {
+  std::size_t I = 0;
+  T Total = T();
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    typename V::Type Acc = V::splat(T());
+    for (auto End = N - N % V::Lanes; I != End; I += V::Lanes)
+      Acc += V::load(P + I);
+    for (std::size_t L = 0; L != V::Lanes; ++L)
+      Total += Acc[L];
+  }
+#endif
+  for (; I < N; ++I)
+    Total += P[I];
+  return Total;
+}
+
+// Requires N > 0.
+template <typename T> T min(const T *P, std::size_t N) {
+  std::size_t I = 0;
+  T Best = P[0];
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    if (N >= V::Lanes) {
+      typename V::Type Acc = V::load(P);
+      I = V::Lanes;
+      for (auto End = N - N % V::Lanes; I != End; I += V::Lanes) {
+        auto X = V::load(P + I);
+        Acc = X < Acc ? X : Acc;
+      }
+      for (std::size_t L = 0; L != V::Lanes; ++L)
+        Best = std::min<T>(Best, Acc[L]);
+    }
+  }
+#endif
+  for (; I < N; ++I)
+    Best = std::min(Best, P[I]);
+  return Best;
+}
+
+// Requires N > 0.
+template <typename T> T max(const T *P, std::size_t N) {
+  std::size_t I = 0;
+  T Best = P[0];
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    if (N >= V::Lanes) {
+      typename V::Type Acc = V::load(P);
+      I = V::Lanes;
+      for (auto End = N - N % V::Lanes; I != End; I += V::Lanes) {
+        auto X = V::load(P + I);
+        Acc = X > Acc ? X : Acc;
+      }
+      for (std::size_t L = 0; L != V::Lanes; ++L)
+        Best = std::max<T>(Best, Acc[L]);
+    }
+  }
+#endif
+  for (; I < N; ++I)
+    Best = std::max(Best, P[I]);
+  return Best;
+}
+
+template <typename T> std::size_t count(const T *P, std::size_t N, T Value) {
+  std::size_t I = 0, Total = 0;
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    auto Needle = V::splat(Value);
+    // Lane counters are as narrow as T, so flush them before they can wrap.
+    constexpr std::size_t Flush = 127;
+    while (N - I >= V::Lanes) {
+      typename V::MaskTy Acc = {};
+      for (std::size_t K = 0; K != Flush && N - I >= V::Lanes;
+           ++K, I += V::Lanes)
+        Acc -= V::load(P + I) == Needle;
+      for (std::size_t L = 0; L != V::Lanes; ++L)
+        Total += static_cast<std::size_t>(Acc[L]);
+    }
+  }
+#endif
+  for (; I < N; ++I)
+    Total += P[I] == Value;
+  return Total;
+}
+
+// Index of the first non-zero element, or N if there is none.
+template <typename T> std::size_t find_first_set(const T *P, std::size_t N) {
+  std::size_t I = 0;
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    auto Zero = V::splat(T());
+    for (auto End = N - N % V::Lanes; I != End; I += V::Lanes)
+      if (V::any(V::load(P + I) != Zero))
+        break;
+  }
+#endif
+  for (; I < N; ++I)
+    if (P[I] != T())
+      return I;
+  return N;
+}
+
+// Dst[i] += Src[i].
+template <typename T> void add(T *Dst, const T *Src, std::size_t N) {
+  std::size_t I = 0;
+#if THREADSAFE_HAS_VECTOR_EXT
+  if constexpr (IsVectorizable<T>) {
+    using V = detail::Vec<T>;
+    for (auto End = N - N % V::Lanes; I != End; I += V::Lanes)
+      V::store(Dst + I, V::load(Dst + I) + V::load(Src + I));
+  }
+#endif
+  for (; I < N; ++I)
+    Dst[I] += Src[I];
+}
+} // namespace threadsafe::simd
@@ -0,0 +1,528 @@
+#pragma once
+
+#include "Queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadsafe {
+// Chase-Lev work-stealing deque (Le et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). The owning thread pushes and takes
+// at the bottom; any other thread may steal from the top. T must be trivially
+// copyable since slots are read speculatively by thieves.
+template <typename T> class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  struct Buffer {
+    std::int64_t Capacity;
+    std::unique_ptr<std::atomic<T>[]> Slots;
+
+    explicit Buffer(std::int64_t Capacity)
+        : Capacity(Capacity), Slots(new std::atomic<T>[Capacity]) {}
+
+    T get(std::int64_t I) const {
+      return Slots[I & (Capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(std::int64_t I, T Value) {
+      Slots[I & (Capacity - 1)].store(Value, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(CacheLineSize) std::atomic<std::int64_t> Top{0};
+  alignas(CacheLineSize) std::atomic<std::int64_t> Bottom{0};
+  std::atomic<Buffer *> TheBuffer;
+  // Buffers retired by grow() stay alive until destruction because a thief
+  // may still be reading from them.
+  std::vector<std::unique_ptr<Buffer>> Buffers;
+
+  Buffer *grow(Buffer *Old, std::int64_t B, std::int64_t T0) {
+    auto New = std::make_unique<Buffer>(Old->Capacity * 2);
+    for (auto I = T0; I != B; ++I)
+      New->put(I, Old->get(I));
+    Buffers.push_back(std::move(New));
+    TheBuffer.store(Buffers.back().get(), std::memory_order_release);
+    return Buffers.back().get();
+  }
+
+public:
+  explicit WorkStealingDeque(std::int64_t Capacity = 256) {
+    Buffers.push_back(std::make_unique<Buffer>(std::bit_ceil(
+        static_cast<std::uint64_t>(std::max<std::int64_t>(Capacity, 2)))));
+    TheBuffer.store(Buffers.back().get(), std::memory_order_relaxed);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  bool empty() const {
+    auto B = Bottom.load(std::memory_order_relaxed);
+    auto T0 = Top.load(std::memory_order_relaxed);
+    return B <= T0;
+  }
+
+  std::size_t size() const {
+    auto B = Bottom.load(std::memory_order_relaxed);
+    auto T0 = Top.load(std::memory_order_relaxed);
+    return B > T0 ? static_cast<std::size_t>(B - T0) : 0;
+  }
+
+  // Owner only.
+  void push(T Value) {
+    auto B = Bottom.load(std::memory_order_relaxed);
+    auto T0 = Top.load(std::memory_order_acquire);
+    auto *Buf = TheBuffer.load(std::memory_order_relaxed);
+    if (B - T0 > Buf->Capacity - 1)
+      Buf = grow(Buf, B, T0);
+    Buf->put(B, Value);
+    // A release store rather than the paper's release fence: the same
+    // guarantee, and one ThreadSanitizer can follow.
+    Bottom.store(B + 1, std::memory_order_release);
+  }
+
+  // Owner only.
+  bool try_pop(T &Value) {
+    auto B = Bottom.load(std::memory_order_relaxed) - 1;
+    auto *Buf = TheBuffer.load(std::memory_order_relaxed);
+    Bottom.store(B, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto T0 = Top.load(std::memory_order_relaxed);
+
+    if (T0 > B) {
+      Bottom.store(B + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    Value = Buf->get(B);
+    if (T0 != B)
+      return true;
+
+    // Last element: race against thieves for it.
+    bool Won = Top.compare_exchange_strong(T0, T0 + 1,
+                                           std::memory_order_seq_cst,
+                                           std::memory_order_relaxed);
+    Bottom.store(B + 1, std::memory_order_relaxed);
+    return Won;
+  }
+
+  // Any thread.
+  bool try_steal(T &Value) {
+    auto T0 = Top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto B = Bottom.load(std::memory_order_acquire);
+    if (T0 >= B)
+      return false;
+
+    auto *Buf = TheBuffer.load(std::memory_order_acquire);
+    auto Candidate = Buf->get(T0);
+    if (!Top.compare_exchange_strong(T0, T0 + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return false;
+    Value = Candidate;
+    return true;
+  }
+};
+
+class ThreadPool {
+  using TaskTy = std::move_only_function<void()>;
+
+  struct alignas(CacheLineSize) Worker {
+    WorkStealingDeque<TaskTy *> Deque;
+    std::uint64_t Seed;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+  Queue<TaskTy *> Injector;
+
+  alignas(CacheLineSize) std::atomic<std::uint64_t> Epoch{0};
+  std::atomic<unsigned> Sleepers{0};
+  std::atomic<bool> Stop{false};
+
+  static ThreadPool *&currentPool() {
+    thread_local ThreadPool *Pool = nullptr;
+    return Pool;
+  }
+
+  static std::size_t &currentIndex() {
+    thread_local std::size_t Index = 0;
+    return Index;
+  }
+
+  Worker *currentWorker() {
+    return currentPool() == this ? Workers[currentIndex()].get() : nullptr;
+  }
+
+  static std::uint64_t nextRandom(std::uint64_t &Seed) {
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 7;
+    Seed ^= Seed << 17;
+    return Seed;
+  }
+
+  void enqueue(TaskTy *Task) {
+    if (auto *W = currentWorker())
+      W->Deque.push(Task);
+    else
+      Injector.push(Task);
+
+    Epoch.fetch_add(1);
+    if (Sleepers.load() != 0)
+      Epoch.notify_one();
+  }
+
+  TaskTy *findTask(Worker *Self) {
+    TaskTy *Task = nullptr;
+    if (Self && Self->Deque.try_pop(Task))
+      return Task;
+    if (Injector.try_pop(Task))
+      return Task;
+
+    if (Workers.empty())
+      return nullptr;
+
+    thread_local std::uint64_t ExternalSeed =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+    auto &Seed = Self ? Self->Seed : ExternalSeed;
+    auto N = Workers.size();
+    auto Start = nextRandom(Seed) % N;
+    for (std::size_t I = 0; I != N; ++I) {
+      auto *Victim = Workers[(Start + I) % N].get();
+      if (Victim != Self && Victim->Deque.try_steal(Task))
+        return Task;
+    }
+    return nullptr;
+  }
+
+  // Smallest chunk worth handing to another thread in the parallel
+  // algorithms below.
+  static constexpr std::size_t MinChunk = 4096;
+
+  // At most one chunk per worker, each at least MinChunk long.
+  std::size_t chunkCount(std::size_t N) const {
+    return std::clamp<std::size_t>(N / MinChunk, 1, size());
+  }
+
+  // Runs Fn(Chunk, Begin, End) on every chunk of [0, N) in parallel and
+  // returns the number of chunks. Chunk C covers [bound(N, Chunks, C),
+  // bound(N, Chunks, C + 1)).
+  template <typename F> std::size_t forChunks(std::size_t N, F &&Fn) {
+    auto Chunks = chunkCount(N);
+    parallel_for(
+        std::size_t(0), Chunks,
+        [&](std::size_t C) {
+          Fn(C, bound(N, Chunks, C), bound(N, Chunks, C + 1));
+        },
+        std::size_t(1));
+    return Chunks;
+  }
+
+  static std::size_t bound(std::size_t N, std::size_t Chunks, std::size_t C) {
+    return N * C / Chunks;
+  }
+
+  // Combines adjacent runs of chunks pairwise, doubling the run length each
+  // round, with Fn(Lo, Mid, Hi) joining chunks [Lo, Mid) and [Mid, Hi).
+  template <typename F> void mergeRounds(std::size_t Chunks, F &&Fn) {
+    for (std::size_t Width = 1; Width < Chunks; Width *= 2) {
+      auto Pairs = (Chunks + 2 * Width - 1) / (2 * Width);
+      parallel_for(
+          std::size_t(0), Pairs,
+          [&](std::size_t P) {
+            auto Lo = P * 2 * Width;
+            auto Mid = Lo + Width;
+            auto Hi = std::min(Lo + 2 * Width, Chunks);
+            if (Mid < Hi)
+              Fn(Lo, Mid, Hi);
+          },
+          std::size_t(1));
+    }
+  }
+
+  template <typename RandomIt, typename Compare, typename SortFn>
+  void mergeSort(RandomIt First, RandomIt Last, Compare &Comp, SortFn Sort) {
+    auto N = static_cast<std::size_t>(Last - First);
+    auto Chunks = forChunks(N, [&](std::size_t, std::size_t B, std::size_t E) {
+      Sort(First + B, First + E, Comp);
+    });
+    mergeRounds(Chunks, [&](std::size_t Lo, std::size_t Mid, std::size_t Hi) {
+      std::inplace_merge(First + bound(N, Chunks, Lo),
+                         First + bound(N, Chunks, Mid),
+                         First + bound(N, Chunks, Hi), Comp);
+    });
+  }
+
+  static void run(TaskTy *Task) {
+    std::unique_ptr<TaskTy> Owner(Task);
+    (*Owner)();
+  }
+
+  void workerLoop(std::size_t Index) {
+    currentPool() = this;
+    currentIndex() = Index;
+    auto *Self = Workers[Index].get();
+
+    for (;;) {
+      if (auto *Task = findTask(Self)) {
+        run(Task);
+        continue;
+      }
+
+      // Park until someone publishes new work. Registering as a sleeper
+      // before re-checking closes the race with enqueue().
+      Sleepers.fetch_add(1);
+      auto E = Epoch.load();
+      if (auto *Task = findTask(Self)) {
+        Sleepers.fetch_sub(1);
+        run(Task);
+        continue;
+      }
+      if (Stop.load()) {
+        Sleepers.fetch_sub(1);
+        return;
+      }
+      Epoch.wait(E);
+      Sleepers.fetch_sub(1);
+    }
+  }
+
+public:
+  explicit ThreadPool(
+      std::size_t NumThreads = std::max(1u, std::thread::hardware_concurrency())) {
+    NumThreads = std::max<std::size_t>(NumThreads, 1);
+    Workers.reserve(NumThreads);
+    for (std::size_t I = 0; I != NumThreads; ++I) {
+      Workers.push_back(std::make_unique<Worker>());
+      Workers.back()->Seed = (I + 1) * 0x9E3779B97F4A7C15ull;
+    }
+
+    Threads.reserve(NumThreads);
+    for (std::size_t I = 0; I != NumThreads; ++I)
+      Threads.emplace_back([this, I] { workerLoop(I); });
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Outstanding tasks are drained before the workers exit.
+  ~ThreadPool() {
+    Stop.store(true);
+    Epoch.fetch_add(1);
+    Epoch.notify_all();
+    for (auto &T : Threads)
+      T.join();
+  }
+
+  std::size_t size() const { return Threads.size(); }
+
+  template <typename F, typename... ArgsTy>
+  auto submit(F &&Fn, ArgsTy &&...Args)
+      -> std::future<std::invoke_result_t<F, ArgsTy...>> {
+    using ResultTy = std::invoke_result_t<F, ArgsTy...>;
+    std::packaged_task<ResultTy()> Task(
+        [Fn = std::forward<F>(Fn),
+         ... Args = std::forward<ArgsTy>(Args)]() mutable -> ResultTy {
+          return std::invoke(std::move(Fn), std::move(Args)...);
+        });
+    auto Future = Task.get_future();
+    enqueue(new TaskTy(std::move(Task)));
+    return Future;
+  }
+
+  template <typename F> void execute(F &&Fn) {
+    enqueue(new TaskTy(std::forward<F>(Fn)));
+  }
+
+  template <typename IndexTy, typename F>
+  void parallel_for(IndexTy First, IndexTy Last, F &&Fn, IndexTy Grain = 0) {
+    static_assert(std::is_integral_v<IndexTy>);
+    if (!(First < Last))
+      return;
+
+    auto Total = static_cast<std::size_t>(Last - First);
+    if (Grain <= 0)
+      Grain = static_cast<IndexTy>(
+          std::max<std::size_t>(1, Total / (size() * 4)));
+    auto Chunks = (Total + Grain - 1) / Grain;
+
+    if (Chunks == 1) {
+      for (auto I = First; I != Last; ++I)
+        Fn(I);
+      return;
+    }
+
+    // Chunks are claimed from a shared counter, by the caller and by up to
+    // one helper task per worker. Helpers may start after the call has
+    // returned, so the counters outlive it; a late helper finds nothing left
+    // to claim and never touches Fn.
+    struct State {
+      std::atomic<std::size_t> Next{0};
+      std::atomic<std::size_t> Remaining;
+      std::exception_ptr Error;
+      std::atomic_flag ErrorSet;
+
+      explicit State(std::size_t Chunks) : Remaining(Chunks) {}
+    };
+    auto Shared = std::make_shared<State>(Chunks);
+
+    auto Drain = [&Fn, First, Total, Grain, Chunks](State &S) {
+      for (;;) {
+        auto C = S.Next.fetch_add(1, std::memory_order_relaxed);
+        if (C >= Chunks)
+          return;
+        auto Begin = static_cast<IndexTy>(First + C * Grain);
+        auto End = static_cast<IndexTy>(
+            std::min<std::size_t>(Total, (C + 1) * Grain) + First);
+        try {
+          for (auto I = Begin; I != End; ++I)
+            Fn(I);
+        } catch (...) {
+          if (!S.ErrorSet.test_and_set())
+            S.Error = std::current_exception();
+        }
+        if (S.Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          S.Remaining.notify_all();
+      }
+    };
+
+    auto Helpers = std::min(Chunks - 1, size());
+    for (std::size_t H = 0; H != Helpers; ++H)
+      execute([Shared, Drain] { Drain(*Shared); });
+    Drain(*Shared);
+
+    // Whatever is left is running on other threads. Wait for it without
+    // running other tasks: the caller may hold a lock that they need.
+    auto &Remaining = Shared->Remaining;
+    for (auto R = Remaining.load(std::memory_order_acquire); R != 0;
+         R = Remaining.load(std::memory_order_acquire))
+      Remaining.wait(R, std::memory_order_acquire);
+
+    // Taken out so that the exception is released here, not by whichever
+    // helper drops the state last.
+    if (auto Error = std::exchange(Shared->Error, nullptr))
+      std::rethrow_exception(Error);
+  }
+
+  template <typename RandomIt, typename F>
+  void parallel_for_each(RandomIt First, RandomIt Last, F &&Fn) {
+    parallel_for(std::ptrdiff_t(0), std::ptrdiff_t(Last - First),
+                 [&](std::ptrdiff_t I) { Fn(First[I]); });
+  }
+
+  // Parallel counterparts of the std algorithms for random-access ranges.
+  // Each one splits the range into a chunk per worker, runs the serial
+  // algorithm on every chunk at once and then stitches the chunks together.
+  // Ranges shorter than two chunks just run the serial algorithm. The
+  // calling thread works on chunks too, so they are safe to call from a
+  // task running on the pool, and it runs no unrelated tasks while it waits,
+  // so they are safe to call with a lock held.
+
+  template <typename RandomIt, typename Compare = std::less<>>
+  void parallel_sort(RandomIt First, RandomIt Last, Compare Comp = {}) {
+    mergeSort(First, Last, Comp,
+              [](RandomIt F, RandomIt L, Compare &C) { std::sort(F, L, C); });
+  }
+
+  // Sorted chunks are merged with std::inplace_merge, which keeps the order
+  // of equal elements, so this is stable.
+  template <typename RandomIt, typename Compare = std::less<>>
+  void parallel_stable_sort(RandomIt First, RandomIt Last, Compare Comp = {}) {
+    mergeSort(First, Last, Comp, [](RandomIt F, RandomIt L, Compare &C) {
+      std::stable_sort(F, L, C);
+    });
+  }
+
+  // Pred must be an equivalence relation, as std::unique requires.
+  template <typename RandomIt, typename BinaryPred = std::equal_to<>>
+  RandomIt parallel_unique(RandomIt First, RandomIt Last,
+                           BinaryPred Pred = {}) {
+    auto N = static_cast<std::size_t>(Last - First);
+    auto Chunks = chunkCount(N);
+    if (Chunks == 1)
+      return std::unique(First, Last, Pred);
+
+    // A chunk drops its leading elements that repeat the last element of the
+    // previous chunk. Count them before any chunk starts moving elements.
+    std::vector<std::size_t> Begin(Chunks), End(Chunks);
+    forChunks(N, [&](std::size_t C, std::size_t B, std::size_t E) {
+      if (C != 0)
+        while (B != E && Pred(First[bound(N, Chunks, C) - 1], First[B]))
+          ++B;
+      Begin[C] = B;
+    });
+    forChunks(N, [&](std::size_t C, std::size_t, std::size_t) {
+      auto B = First + Begin[C];
+      End[C] = static_cast<std::size_t>(
+          std::unique(B, First + bound(N, Chunks, C + 1), Pred) - First);
+    });
+
+    // Compacting is serial: a chunk's destination can overlap the elements
+    // its predecessor has yet to move.
+    auto Out = First + (End[0] - Begin[0]);
+    for (std::size_t C = 1; C != Chunks; ++C)
+      Out = std::move(First + Begin[C], First + End[C], Out);
+    return Out;
+  }
+
+  template <typename RandomIt, typename UnaryPred>
+  RandomIt parallel_partition(RandomIt First, RandomIt Last, UnaryPred Pred) {
+    auto N = static_cast<std::size_t>(Last - First);
+    std::vector<std::size_t> Split(chunkCount(N));
+    auto Chunks =
+        forChunks(N, [&](std::size_t C, std::size_t B, std::size_t E) {
+          Split[C] = static_cast<std::size_t>(
+              std::partition(First + B, First + E, Pred) - First);
+        });
+    // Joining [T1 F1] and [T2 F2] rotates F1 past T2.
+    mergeRounds(Chunks, [&](std::size_t Lo, std::size_t Mid, std::size_t) {
+      auto MidPos = bound(N, Chunks, Mid);
+      std::rotate(First + Split[Lo], First + MidPos, First + Split[Mid]);
+      Split[Lo] += Split[Mid] - MidPos;
+    });
+    return First + Split[0];
+  }
+
+  // DFirst may equal First for an in-place transform.
+  template <typename RandomIt, typename OutIt, typename UnaryOp>
+  OutIt parallel_transform(RandomIt First, RandomIt Last, OutIt DFirst,
+                           UnaryOp Op) {
+    auto N = static_cast<std::size_t>(Last - First);
+    forChunks(N, [&](std::size_t, std::size_t B, std::size_t E) {
+      std::transform(First + B, First + E, DFirst + B, Op);
+    });
+    return DFirst + N;
+  }
+
+  // Op must be associative. Partial results are combined in order, so it
+  // need not be commutative.
+  template <typename RandomIt, typename T, typename BinaryOp = std::plus<>>
+  T parallel_reduce(RandomIt First, RandomIt Last, T Init, BinaryOp Op = {}) {
+    auto N = static_cast<std::size_t>(Last - First);
+    std::vector<std::optional<T>> Partial(chunkCount(N));
+    forChunks(N, [&](std::size_t C, std::size_t B, std::size_t E) {
+      if (B == E)
+        return;
+      T Acc = First[B];
+      for (auto I = B + 1; I != E; ++I)
+        Acc = Op(std::move(Acc), First[I]);
+      Partial[C] = std::move(Acc);
+    });
+    for (auto &P : Partial)
+      if (P)
+        Init = Op(std::move(Init), std::move(*P));
+    return Init;
+  }
+};
+} // namespace threadsafe
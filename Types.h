@@ -1,7 +1,12 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <new>
 #include <shared_mutex>
+#include <thread>
 
 #if __cplusplus >= 201703L
 using SharedMutexTy = std::shared_mutex;
@@ -17,4 +22,45 @@ using WriteLockTy = std::unique_lock<SharedMutexTy>;
 #define THREADSAFE_CONSTEXPR_20 constexpr
 #else
 #define THREADSAFE_CONSTEXPR_20
-#endif
\ No newline at end of file
+#endif
+
+namespace threadsafe {
+#ifdef __cpp_lib_hardware_interference_size
+inline constexpr std::size_t CacheLineSize =
+    std::hardware_destructive_interference_size;
+#else
+inline constexpr std::size_t CacheLineSize = 64;
+#endif
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Stable per-thread hash for spreading threads over striped counters.
+inline std::size_t threadHash() {
+  thread_local const std::size_t Hash = static_cast<std::size_t>(
+      (std::uint64_t(std::hash<std::thread::id>()(std::this_thread::get_id())) *
+       0x9E3779B97F4A7C15ull) >>
+      32);
+  return Hash;
+}
+
+// Spin briefly, then start yielding so a preempted lock holder can run.
+class Backoff {
+  unsigned Spins = 0;
+
+public:
+  void pause() {
+    if (Spins < 64) {
+      ++Spins;
+      cpuRelax();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+};
+} // namespace threadsafe
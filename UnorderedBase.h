@@ -0,0 +1,1078 @@
+#pragma once
+
+#include "Atomically.h"
+#include "BloomFilter.h"
+#include "Epoch.h"
+#include "FlatCombiner.h"
+#include "Locks.h"
+#include "Memory.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace threadsafe {
+namespace detail {
+// The locking engine behind UnorderedMap, UnorderedSet and UnorderedMultiMap.
+// It wraps any std unordered container BaseTy behind one LockTy and supplies
+// everything the three share: construction, the std-style interface, the
+// visitors and the batched operations. Derived adds only what is specific to
+// its kind of container.
+template <typename Derived, typename BaseTyArg, typename LockTy>
+class UnorderedBase {
+protected:
+  using BaseTy = BaseTyArg;
+  using ReadLockTy = std::shared_lock<LockTy>;
+  using WriteLockTy = std::unique_lock<LockTy>;
+  // Map elements can be mutated in place, so visiting them is a write; set
+  // elements are immutable and can be visited under the shared lock.
+  using VisitLockTy =
+      std::conditional_t<std::is_const_v<std::remove_reference_t<
+                             std::iter_reference_t<typename BaseTy::iterator>>>,
+                         ReadLockTy, WriteLockTy>;
+
+  using KeyTy = BaseTy::key_type;
+  using SizeTy = BaseTy::size_type;
+
+  // State for the optional Bloom filter, allocated by the first
+  // enable_bloom_filter() and kept until the container is destroyed.
+  struct FilterState {
+    static constexpr std::size_t NumStripes = 32;
+
+    struct alignas(CacheLineSize) Stripe {
+      std::atomic<std::uint64_t> Rejected{0};
+      std::atomic<std::uint64_t> Passed{0};
+      std::atomic<std::uint64_t> FalsePositives{0};
+    };
+
+    typename BaseTy::hasher Hash;
+    double BitsPerKey;
+    std::atomic<BloomFilter *> Active{nullptr};
+    // Set when the contents changed wholesale and a new filter couldn't be
+    // built on the spot; lookups ignore Active until the next publish.
+    std::atomic<bool> Stale{false};
+    EpochDomain Reclaimer;
+    std::array<Stripe, NumStripes> Stripes;
+    std::atomic<std::size_t> Builds{0};
+    std::atomic<bool> Rebuilding{false};
+    // Guarded by TheMutex.
+    bool Enabled = true;
+    SizeTy Erased = 0;
+    std::jthread Rebuilder;
+
+    FilterState(const typename BaseTy::hasher &H, double Bits)
+        : Hash(H), BitsPerKey(Bits) {}
+
+    ~FilterState() {
+      if (Rebuilder.joinable()) {
+        Rebuilder.request_stop();
+        Rebuilder.join();
+      }
+      delete Active.load(std::memory_order_relaxed);
+    }
+
+    Stripe &stripe() { return Stripes[threadHash() % NumStripes]; }
+  };
+
+  static constexpr SizeTy MinFilterCapacity = 1024;
+
+  BaseTy Raw;
+
+  mutable LockTy TheMutex;
+
+  std::atomic<FilterState *> Filtering{nullptr};
+
+  // Allocated by the first enable_combining(), combine() or combine_async()
+  // and kept until the container is destroyed.
+  mutable std::atomic<FlatCombiner<LockTy> *> Combining{nullptr};
+  std::atomic<bool> CombineWrites{false};
+
+  MemoryRegistration Registration;
+
+  static const KeyTy &keyOf(const typename BaseTy::value_type &V) {
+    if constexpr (std::is_same_v<KeyTy, typename BaseTy::value_type>)
+      return V;
+    else
+      return V.first;
+  }
+
+  // Derived classes befriend ContainerAccess and re-export TheMutex and raw()
+  // to it. atomically() can change the contents behind the filter's back, so
+  // lookups bypass the filter until it has been rebuilt.
+  BaseTy &raw() {
+    if (auto *F = Filtering.load(std::memory_order_relaxed);
+        F && F->Active.load(std::memory_order_relaxed)) {
+      retireFilter(*F);
+      scheduleRebuild(*F);
+    }
+    return Raw;
+  }
+
+  enum class Probe { Unfiltered, Absent, Maybe };
+
+  // Consults the Bloom filter, if there is one, without taking TheMutex.
+  Probe probe(const KeyTy &K) const {
+    auto *F = Filtering.load(std::memory_order_acquire);
+    if (!F)
+      return Probe::Unfiltered;
+    auto Guard = F->Reclaimer.pin();
+    // Stale before Active: publishFilter() stores them the other way round.
+    if (F->Stale.load(std::memory_order_acquire))
+      return Probe::Unfiltered;
+    auto *BF = F->Active.load(std::memory_order_acquire);
+    if (!BF)
+      return Probe::Unfiltered;
+    if (BF->may_contain(F->Hash(K)))
+      return Probe::Maybe;
+    F->stripe().Rejected.fetch_add(1, std::memory_order_relaxed);
+    return Probe::Absent;
+  }
+
+  // Records whether a lookup that the filter let through found anything.
+  void record(Probe P, bool Found) const {
+    if (P != Probe::Maybe)
+      return;
+    auto &S = Filtering.load(std::memory_order_relaxed)->stripe();
+    (Found ? S.Passed : S.FalsePositives)
+        .fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // The write-side hooks below run with TheMutex held exclusively.
+
+  void noteInsert(const KeyTy &K) {
+    auto *F = Filtering.load(std::memory_order_relaxed);
+    if (!F)
+      return;
+    if (auto *BF = F->Active.load(std::memory_order_relaxed)) {
+      BF->insert(F->Hash(K));
+      if (Raw.size() > BF->capacity())
+        scheduleRebuild(*F);
+    }
+  }
+
+  // Adds the key of the element an insert returned (inserted or already
+  // present) to the filter and passes the result through.
+  template <typename R> R noted(R Result) {
+    if (Filtering.load(std::memory_order_relaxed)) {
+      auto It = [&] {
+        if constexpr (requires { Result.position; })
+          return Result.position;
+        else if constexpr (requires { Result.second; })
+          return Result.first;
+        else
+          return Result;
+      }();
+      if (It != Raw.end())
+        noteInsert(keyOf(*It));
+    }
+    return Result;
+  }
+
+  // Erased keys leave stale bits behind; rebuild once they add up.
+  void noteErase(SizeTy N) {
+    auto *F = Filtering.load(std::memory_order_relaxed);
+    if (!F || N == 0)
+      return;
+    F->Erased += N;
+    if (auto *BF = F->Active.load(std::memory_order_relaxed);
+        BF && F->Erased > BF->capacity() / 2)
+      scheduleRebuild(*F);
+  }
+
+  // Needs TheMutex held, shared or exclusive.
+  std::unique_ptr<BloomFilter> buildFilter(const FilterState &F) const {
+    auto BF = std::make_unique<BloomFilter>(
+        std::max(Raw.size() * 2, MinFilterCapacity), F.BitsPerKey);
+    for (const auto &V : Raw)
+      BF->insert(F.Hash(keyOf(V)));
+    return BF;
+  }
+
+  static void retire(FilterState &F, BloomFilter *BF) {
+    if (BF)
+      F.Reclaimer.retire(
+          BF, [](void *P) { delete static_cast<BloomFilter *>(P); });
+  }
+
+  // Needs TheMutex held, shared or exclusive; writers must be excluded.
+  static void publishFilter(FilterState &F, std::unique_ptr<BloomFilter> BF) {
+    F.Erased = 0;
+    F.Builds.fetch_add(1, std::memory_order_relaxed);
+    retire(F, F.Active.exchange(BF.release(), std::memory_order_acq_rel));
+    F.Stale.store(false, std::memory_order_release);
+  }
+
+  static void retireFilter(FilterState &F) {
+    retire(F, F.Active.exchange(nullptr, std::memory_order_acq_rel));
+  }
+
+  FlatCombiner<LockTy> &combiner() const {
+    auto *C = Combining.load(std::memory_order_acquire);
+    if (C)
+      return *C;
+    auto New = std::make_unique<FlatCombiner<LockTy>>(TheMutex);
+    if (Combining.compare_exchange_strong(C, New.get(),
+                                          std::memory_order_acq_rel))
+      return *New.release();
+    return *C;
+  }
+
+  // Runs a single-element write under the exclusive lock, handing it to the
+  // combiner when enable_combining() is in effect. F works on Raw and reports
+  // its inserts and erases itself, so the Bloom filter stays valid.
+  template <typename Fn> decltype(auto) mutate(Fn &&F) {
+    if (CombineWrites.load(std::memory_order_relaxed))
+      return combiner().execute(F);
+    std::lock_guard Lock(TheMutex);
+    return std::invoke(F);
+  }
+
+  // Rebuilds the filter of a container whose contents were replaced
+  // wholesale. Doesn't throw, so that swap() and move assignment can stay
+  // noexcept: if the build fails, lookups go unfiltered until a background
+  // rebuild succeeds.
+  void refreshFilter() noexcept {
+    auto *F = Filtering.load(std::memory_order_relaxed);
+    if (!F || !F->Enabled)
+      return;
+    try {
+      publishFilter(*F, buildFilter(*F));
+    } catch (...) {
+      F->Stale.store(true, std::memory_order_release);
+      try {
+        // Inline with NullLock, so it can fail again; then the filter
+        // stays bypassed until the next rebuild.
+        scheduleRebuild(*F);
+      } catch (...) {
+      }
+    }
+  }
+
+  // Builds a fresh filter on a background thread, under the shared lock so
+  // readers carry on. With NullLock there is no lock to share, so the rebuild
+  // runs inline.
+  void scheduleRebuild(FilterState &F) {
+    if constexpr (std::is_same_v<LockTy, NullLock>) {
+      publishFilter(F, buildFilter(F));
+    } else {
+      if (F.Rebuilding.exchange(true, std::memory_order_acquire))
+        return;
+      try {
+        F.Rebuilder = std::jthread([this, &F](std::stop_token Stop) {
+          try {
+            ReadLockTy Lock(TheMutex);
+            try {
+              if (!Stop.stop_requested() && F.Enabled)
+                publishFilter(F, buildFilter(F));
+            } catch (...) {
+              // Keep the old filter; it is only less precise.
+            }
+            // Cleared before the lock is released: a writer that retires
+            // the filter once we're done must be able to schedule another
+            // rebuild rather than find this one still marked as running.
+            F.Rebuilding.store(false, std::memory_order_release);
+          } catch (...) {
+            F.Rebuilding.store(false, std::memory_order_release);
+          }
+        });
+      } catch (...) {
+        F.Rebuilding.store(false, std::memory_order_relaxed);
+      }
+    }
+  }
+
+public:
+  using key_type = BaseTy::key_type;
+  using hasher = BaseTy::hasher;
+  using key_equal = BaseTy::key_equal;
+  using allocator_type = BaseTy::allocator_type;
+  using value_type = BaseTy::value_type;
+  using reference = BaseTy::reference;
+  using const_reference = BaseTy::const_reference;
+  using pointer = BaseTy::pointer;
+  using const_pointer = BaseTy::const_pointer;
+  using size_type = BaseTy::size_type;
+  using difference_type = BaseTy::difference_type;
+  using iterator = BaseTy::iterator;
+  using const_iterator = BaseTy::const_iterator;
+  using local_iterator = BaseTy::local_iterator;
+  using const_local_iterator = BaseTy::const_local_iterator;
+  using lock_type = LockTy;
+
+#if __cplusplus >= 201703L
+  using node_type = BaseTy::node_type;
+#endif
+
+  UnorderedBase() noexcept(
+      std::is_nothrow_default_constructible_v<hasher> &&
+      std::is_nothrow_default_constructible_v<key_equal> &&
+      std::is_nothrow_default_constructible_v<allocator_type>) = default;
+
+  explicit UnorderedBase(size_type N, const hasher &HF = hasher(),
+                         const key_equal &Eql = key_equal(),
+                         const allocator_type &A = allocator_type())
+      : Raw(N, HF, Eql, A) {}
+
+  template <typename InputIterator>
+  UnorderedBase(InputIterator F, InputIterator L, size_type N = 0,
+                const hasher &HF = hasher(), const key_equal &Eql = key_equal(),
+                const allocator_type &A = allocator_type())
+      : Raw(F, L, N, HF, Eql, A) {}
+
+#if __cplusplus >= 202300L
+  template <typename R>
+  UnorderedBase(std::from_range_t, R &&Rg, size_type N = 0,
+                const hasher &HF = hasher(), const key_equal &Eql = key_equal(),
+                const allocator_type &A = allocator_type())
+      : Raw(std::from_range, std::forward<R>(Rg), N, HF, Eql, A) {}
+#endif
+
+  explicit UnorderedBase(const allocator_type &A) : Raw(A) {}
+
+  UnorderedBase(const UnorderedBase &Other) {
+    ReadLockTy Lock(Other.TheMutex);
+    Raw = Other.Raw;
+  }
+
+  UnorderedBase(const UnorderedBase &Other, const allocator_type &A) {
+    ReadLockTy Lock(Other.TheMutex);
+    Raw = BaseTy(Other.Raw, A);
+  }
+
+  UnorderedBase(UnorderedBase &&Other) noexcept(
+      std::is_nothrow_move_constructible_v<hasher> &&
+      std::is_nothrow_move_constructible_v<key_equal> &&
+      std::is_nothrow_move_constructible_v<allocator_type>) {
+    std::lock_guard Lock(Other.TheMutex);
+    Raw = std::move(Other.Raw);
+  }
+
+  UnorderedBase(UnorderedBase &&Other, const allocator_type &A) {
+    std::shared_lock Lock(Other.TheMutex);
+    Raw = BaseTy(std::move(Other.Raw), A);
+  }
+
+  UnorderedBase(std::initializer_list<value_type> IL, size_type N = 0,
+                const hasher &HF = hasher(), const key_equal &Eql = key_equal(),
+                const allocator_type &A = allocator_type())
+      : Raw(IL, N, HF, Eql, A) {}
+
+  UnorderedBase(size_type N, const allocator_type &A)
+      : UnorderedBase(N, hasher(), key_equal(), A) {}
+
+  UnorderedBase(size_type N, const hasher &HF, const allocator_type &A)
+      : UnorderedBase(N, HF, key_equal(), A) {}
+
+  template <typename InputIterator>
+  UnorderedBase(InputIterator F, InputIterator L, size_type N,
+                const allocator_type &A)
+      : UnorderedBase(F, L, N, hasher(), key_equal(), A) {}
+
+  template <typename InputIterator>
+  UnorderedBase(InputIterator F, InputIterator L, size_type N, const hasher &HF,
+                const allocator_type &A)
+      : UnorderedBase(F, L, N, HF, key_equal(), A) {}
+
+#if __cplusplus >= 202300L
+  template <typename R>
+  UnorderedBase(std::from_range_t, R &&Rg, size_type N, const allocator_type &A)
+      : UnorderedBase(std::from_range, std::forward<R>(Rg), N, hasher(),
+                      key_equal(), A) {}
+
+  template <typename R>
+  UnorderedBase(std::from_range_t, R &&Rg, size_type N, const hasher &HF,
+                const allocator_type &A)
+      : UnorderedBase(std::from_range, std::forward<R>(Rg), N, HF, key_equal(),
+                      A) {}
+#endif
+
+  UnorderedBase(std::initializer_list<value_type> IL, size_type N,
+                const allocator_type &A)
+      : UnorderedBase(IL, N, hasher(), key_equal(), A) {}
+
+  UnorderedBase(std::initializer_list<value_type> IL, size_type N,
+                const hasher &HF, const allocator_type &A)
+      : UnorderedBase(IL, N, HF, key_equal(), A) {}
+
+  // Unregister before anything memory_usage() reads is gone. The combiner
+  // goes next: it still runs whatever was submitted.
+  ~UnorderedBase() {
+    Registration.reset();
+    delete Combining.load(std::memory_order_relaxed);
+    delete Filtering.load(std::memory_order_relaxed);
+  }
+
+  UnorderedBase &operator=(const UnorderedBase &Other) {
+    if (this == &Other)
+      return *this;
+
+    WriteLockTy Lock1(TheMutex, std::defer_lock);
+    ReadLockTy Lock2(Other.TheMutex, std::defer_lock);
+    std::lock(Lock1, Lock2);
+    Raw = Other.Raw;
+    refreshFilter();
+    return *this;
+  }
+
+  UnorderedBase &operator=(UnorderedBase &&Other) noexcept(
+      allocator_type::propagate_on_container_move_assignment::value &&
+      std::is_nothrow_move_assignable_v<allocator_type> &&
+      std::is_nothrow_move_assignable_v<hasher> &&
+      std::is_nothrow_move_assignable_v<key_equal>) {
+    if (this == &Other)
+      return *this;
+
+#if __cplusplus >= 201703L
+    std::scoped_lock Lock(TheMutex, Other.TheMutex);
+#else
+    WriteLockTy Lock1(TheMutex, std::defer_lock);
+    ReadLockTy Lock2(Other.TheMutex, std::defer_lock);
+    std::lock(Lock1, Lock2);
+#endif
+    Raw = std::move(Other.Raw);
+    refreshFilter();
+    return *this;
+  }
+
+  Derived &operator=(std::initializer_list<value_type> IL) {
+    std::lock_guard Lock(TheMutex);
+    Raw = IL;
+    refreshFilter();
+    return static_cast<Derived &>(*this);
+  }
+
+  allocator_type get_allocator() const noexcept { return Raw.get_allocator(); }
+
+  bool empty() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.empty();
+  }
+
+  size_type size() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.size();
+  }
+
+  size_type max_size() const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.max_size();
+  }
+
+  iterator begin() noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.begin();
+  }
+
+  iterator end() noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.end();
+  }
+
+  const_iterator begin() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.begin();
+  }
+
+  const_iterator end() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.end();
+  }
+
+  const_iterator cbegin() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.cbegin();
+  }
+
+  const_iterator cend() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.cend();
+  }
+
+  template <typename... Args> auto emplace(Args &&...A) {
+    return mutate([&] { return noted(Raw.emplace(std::forward<Args>(A)...)); });
+  }
+
+  template <typename... Args>
+  iterator emplace_hint(const_iterator Position, Args &&...A) {
+    std::lock_guard Lock(TheMutex);
+    return noted(Raw.emplace_hint(Position, std::forward<Args>(A)...));
+  }
+
+  auto insert(const value_type &Obj) {
+    return mutate([&] { return noted(Raw.insert(Obj)); });
+  }
+
+  template <typename P> auto insert(P &&Obj) {
+    return mutate([&] { return noted(Raw.insert(std::forward<P>(Obj))); });
+  }
+
+  iterator insert(const_iterator Hint, const value_type &Obj) {
+    std::lock_guard Lock(TheMutex);
+    return noted(Raw.insert(Hint, Obj));
+  }
+
+  template <typename P> iterator insert(const_iterator Hint, P &&Obj) {
+    std::lock_guard Lock(TheMutex);
+    return noted(Raw.insert(Hint, std::forward<P>(Obj)));
+  }
+
+  template <typename InputIterator>
+  void insert(InputIterator First, InputIterator Last) {
+    std::lock_guard Lock(TheMutex);
+    if (!Filtering.load(std::memory_order_relaxed))
+      return Raw.insert(First, Last);
+    for (; First != Last; ++First)
+      noted(Raw.insert(*First));
+  }
+
+#if __cplusplus >= 202300L
+  template <typename R> void insert_range(R &&Rg) {
+    std::lock_guard Lock(TheMutex);
+    if (!Filtering.load(std::memory_order_relaxed))
+      return Raw.insert(std::from_range, std::forward<R>(Rg));
+    for (auto &&V : Rg)
+      noted(Raw.insert(std::forward<decltype(V)>(V)));
+  }
+#endif
+
+  void insert(std::initializer_list<value_type> IL) {
+    insert(IL.begin(), IL.end());
+  }
+
+  node_type extract(const_iterator Position) {
+    std::lock_guard Lock(TheMutex);
+    noteErase(1);
+    return Raw.extract(Position);
+  }
+
+  node_type extract(const key_type &X) {
+    std::lock_guard Lock(TheMutex);
+    auto NH = Raw.extract(X);
+    noteErase(!NH.empty());
+    return NH;
+  }
+
+  auto insert(node_type &&NH) {
+    std::lock_guard Lock(TheMutex);
+    return noted(Raw.insert(std::move(NH)));
+  }
+
+  iterator insert(const_iterator Hint, node_type &&NH) {
+    std::lock_guard Lock(TheMutex);
+    return noted(Raw.insert(Hint, std::move(NH)));
+  }
+
+  iterator erase(const_iterator Position) {
+    std::lock_guard Lock(TheMutex);
+    noteErase(1);
+    return Raw.erase(Position);
+  }
+
+  iterator erase(iterator Position)
+    requires(!std::is_same_v<iterator, const_iterator>)
+  {
+    std::lock_guard Lock(TheMutex);
+    noteErase(1);
+    return Raw.erase(Position);
+  }
+
+  size_type erase(const key_type &K) {
+    return mutate([&] {
+      auto N = Raw.erase(K);
+      noteErase(N);
+      return N;
+    });
+  }
+
+  iterator erase(const_iterator First, const_iterator Last) {
+    std::lock_guard Lock(TheMutex);
+    auto Before = Raw.size();
+    auto It = Raw.erase(First, Last);
+    noteErase(Before - Raw.size());
+    return It;
+  }
+
+  void clear() noexcept {
+    std::lock_guard Lock(TheMutex);
+    noteErase(Raw.size());
+    Raw.clear();
+  }
+
+  template <typename Source> void merge(Source &&S) {
+    std::lock_guard Lock(TheMutex);
+    // Noting every source key over-approximates, which only costs precision.
+    if (Filtering.load(std::memory_order_relaxed))
+      for (const auto &V : S)
+        noteInsert(keyOf(V));
+    Raw.merge(std::forward<Source>(S));
+  }
+
+  void swap(Derived &Other) noexcept(std::is_nothrow_swappable_v<BaseTy>) {
+    if (this == &Other)
+      return;
+
+    UnorderedBase &O = Other;
+    std::scoped_lock lock(TheMutex, O.TheMutex);
+    Raw.swap(O.Raw);
+    refreshFilter();
+    O.refreshFilter();
+  }
+
+  hasher hash_function() const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.hash_function();
+  }
+
+  key_equal key_eq() const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.key_eq();
+  }
+
+  iterator find(const key_type &K) {
+    auto P = probe(K);
+    // end() doesn't depend on the table, so it is safe to form unlocked.
+    if (P == Probe::Absent)
+      return Raw.end();
+    ReadLockTy Lock(TheMutex);
+    auto It = Raw.find(K);
+    record(P, It != Raw.end());
+    return It;
+  }
+
+  const_iterator find(const key_type &K) const {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return Raw.end();
+    ReadLockTy Lock(TheMutex);
+    auto It = Raw.find(K);
+    record(P, It != Raw.end());
+    return It;
+  }
+
+#if __cplusplus >= 202000L
+  template <typename K> iterator find(const K &X) {
+    ReadLockTy Lock(TheMutex);
+    return Raw.find(X);
+  }
+
+  template <typename K> const_iterator find(const K &X) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.find(X);
+  }
+#endif
+
+  size_type count(const key_type &K) const {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return 0;
+    ReadLockTy Lock(TheMutex);
+    auto N = Raw.count(K);
+    record(P, N != 0);
+    return N;
+  }
+
+#if __cplusplus >= 202000L
+  template <typename KeyTy> size_type count(const KeyTy &K) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.count(K);
+  }
+
+  bool contains(const key_type &K) const {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return false;
+    ReadLockTy Lock(TheMutex);
+    bool Found = Raw.contains(K);
+    record(P, Found);
+    return Found;
+  }
+
+  template <typename KeyTy> bool contains(const KeyTy &K) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.contains(K);
+  }
+#endif
+
+  std::pair<iterator, iterator> equal_range(const key_type &K) {
+    ReadLockTy Lock(TheMutex);
+    return Raw.equal_range(K);
+  };
+
+  std::pair<const_iterator, const_iterator>
+  equal_range(const key_type &K) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.equal_range(K);
+  }
+
+#if __cplusplus >= 202000L
+  template <typename KeyTy>
+  std::pair<iterator, iterator> equal_range(const KeyTy &K) {
+    ReadLockTy Lock(TheMutex);
+    return Raw.equal_range(K);
+  }
+
+  template <typename KeyTy>
+  std::pair<const_iterator, const_iterator> equal_range(const KeyTy &K) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.equal_range(K);
+  }
+#endif
+
+  size_type bucket_count() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.bucket_count();
+  }
+
+  size_type max_bucket_count() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.max_bucket_count();
+  }
+
+  size_type bucket_size(size_type N) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.bucket_size(N);
+  }
+
+  size_type bucket(const key_type &K) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.bucket(K);
+  }
+
+  local_iterator begin(size_type N) {
+    ReadLockTy Lock(TheMutex);
+    return Raw.begin(N);
+  }
+
+  local_iterator end(size_type N) {
+    ReadLockTy Lock(TheMutex);
+    return Raw.end(N);
+  }
+
+  const_local_iterator begin(size_type N) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.begin(N);
+  }
+
+  const_local_iterator end(size_type N) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.end(N);
+  }
+
+  const_local_iterator cbegin(size_type N) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.cbegin(N);
+  }
+
+  const_local_iterator cend(size_type N) const {
+    ReadLockTy Lock(TheMutex);
+    return Raw.cend(N);
+  }
+
+  float load_factor() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.load_factor();
+  }
+
+  float max_load_factor() const noexcept {
+    ReadLockTy Lock(TheMutex);
+    return Raw.max_load_factor();
+  }
+
+  void max_load_factor(float Z) {
+    std::lock_guard Lock(TheMutex);
+    Raw.max_load_factor(Z);
+  }
+
+  void rehash(size_type N) {
+    std::lock_guard Lock(TheMutex);
+    Raw.rehash(N);
+  }
+
+  void reserve(size_type N) {
+    std::lock_guard Lock(TheMutex);
+    Raw.reserve(N);
+  }
+  // Visitors run Fn on elements in place with the lock held, so no reference
+  // escapes the critical section. Fn must not call back into the container.
+
+  // Calls Fn on the element with key K (the first one, for a multimap).
+  // Returns false if there is none.
+  template <typename F> bool visit(const key_type &K, F &&Fn) {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return false;
+    VisitLockTy Lock(TheMutex);
+    auto It = Raw.find(K);
+    record(P, It != Raw.end());
+    if (It == Raw.end())
+      return false;
+    std::invoke(Fn, *It);
+    return true;
+  }
+
+  template <typename F> bool cvisit(const key_type &K, F &&Fn) const {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return false;
+    ReadLockTy Lock(TheMutex);
+    auto It = Raw.find(K);
+    record(P, It != Raw.end());
+    if (It == Raw.end())
+      return false;
+    std::invoke(Fn, *It);
+    return true;
+  }
+
+  template <typename F> size_type visit_all(F &&Fn) {
+    VisitLockTy Lock(TheMutex);
+    for (auto &V : Raw)
+      std::invoke(Fn, V);
+    return Raw.size();
+  }
+
+  template <typename F> size_type cvisit_all(F &&Fn) const {
+    ReadLockTy Lock(TheMutex);
+    for (const auto &V : Raw)
+      std::invoke(Fn, V);
+    return Raw.size();
+  }
+
+  template <typename Predicate> size_type erase_if(Predicate P) {
+    std::lock_guard Lock(TheMutex);
+    auto N = std::erase_if(Raw, P);
+    noteErase(N);
+    return N;
+  }
+
+  // Batched operations take the lock once for the whole batch instead of once
+  // per element. Lookups the Bloom filter rejects don't need the lock, so it
+  // is only taken once some key gets past the filter.
+
+  // Inserts every element of Values and returns how many were added.
+  template <typename Range> size_type insert_batch(Range &&Values) {
+    std::lock_guard Lock(TheMutex);
+    auto Before = Raw.size();
+    for (auto &&V : Values)
+      noted(Raw.insert(std::forward<decltype(V)>(V)));
+    return Raw.size() - Before;
+  }
+
+  // Erases every element whose key is in Keys and returns how many went.
+  template <typename KeyRange> size_type erase_batch(const KeyRange &Keys) {
+    std::lock_guard Lock(TheMutex);
+    size_type Erased = 0;
+    for (const auto &K : Keys)
+      Erased += Raw.erase(K);
+    noteErase(Erased);
+    return Erased;
+  }
+
+  // Writes one bool per key in Keys to Out.
+  template <typename KeyRange, typename OutputIt>
+  OutputIt contains_batch(const KeyRange &Keys, OutputIt Out) const {
+    ReadLockTy Lock(TheMutex, std::defer_lock);
+    for (const auto &K : Keys) {
+      auto P = probe(K);
+      bool Found = false;
+      if (P != Probe::Absent) {
+        if (!Lock.owns_lock())
+          Lock.lock();
+        Found = Raw.find(K) != Raw.end();
+        record(P, Found);
+      }
+      *Out++ = Found;
+    }
+    return Out;
+  }
+
+  // Calls Fn on the element for each key in Keys that is present and returns
+  // how many were found.
+  template <typename KeyRange, typename F>
+  size_type visit_batch(const KeyRange &Keys, F &&Fn) {
+    VisitLockTy Lock(TheMutex, std::defer_lock);
+    size_type Found = 0;
+    for (const auto &K : Keys) {
+      auto P = probe(K);
+      if (P == Probe::Absent)
+        continue;
+      if (!Lock.owns_lock())
+        Lock.lock();
+      auto It = Raw.find(K);
+      record(P, It != Raw.end());
+      if (It != Raw.end()) {
+        std::invoke(Fn, *It);
+        ++Found;
+      }
+    }
+    return Found;
+  }
+
+  template <typename KeyRange, typename F>
+  size_type cvisit_batch(const KeyRange &Keys, F &&Fn) const {
+    ReadLockTy Lock(TheMutex, std::defer_lock);
+    size_type Found = 0;
+    for (const auto &K : Keys) {
+      auto P = probe(K);
+      if (P == Probe::Absent)
+        continue;
+      if (!Lock.owns_lock())
+        Lock.lock();
+      auto It = Raw.find(K);
+      record(P, It != Raw.end());
+      if (It != Raw.end()) {
+        std::invoke(Fn, std::as_const(*It));
+        ++Found;
+      }
+    }
+    return Found;
+  }
+
+  // Puts a blocked Bloom filter (see BloomFilter.h) in front of find, count,
+  // contains and the visitors for key_type keys, so most lookups of absent
+  // keys return without taking TheMutex or touching the table. Inserts add
+  // their keys to the filter under the write lock. Erased keys can't be
+  // removed from it, so once enough have been erased, or the container has
+  // outgrown the filter, a background thread builds a fresh one under the
+  // shared lock and swaps it in. atomically() drops the filter until that
+  // rebuild is done. Copies and moves start without a filter.
+  void enable_bloom_filter(double BitsPerKey = 10) {
+    std::lock_guard Lock(TheMutex);
+    auto *F = Filtering.load(std::memory_order_relaxed);
+    if (!F) {
+      F = new FilterState(Raw.hash_function(), BitsPerKey);
+      Filtering.store(F, std::memory_order_release);
+    }
+    F->BitsPerKey = BitsPerKey;
+    F->Enabled = true;
+    publishFilter(*F, buildFilter(*F));
+  }
+
+  void disable_bloom_filter() {
+    std::lock_guard Lock(TheMutex);
+    if (auto *F = Filtering.load(std::memory_order_relaxed)) {
+      F->Enabled = false;
+      retireFilter(*F);
+    }
+  }
+
+  // Rebuilds the filter now, on the calling thread.
+  void rebuild_bloom_filter() {
+    std::lock_guard Lock(TheMutex);
+    refreshFilter();
+  }
+
+  BloomFilterStats bloom_filter_stats() const {
+    BloomFilterStats Stats;
+    auto *F = Filtering.load(std::memory_order_acquire);
+    if (!F)
+      return Stats;
+    {
+      auto Guard = F->Reclaimer.pin();
+      if (auto *BF = F->Active.load(std::memory_order_acquire)) {
+        Stats.Enabled = true;
+        Stats.Capacity = BF->capacity();
+        Stats.Bytes = BF->size_bytes();
+      }
+    }
+    Stats.Builds = F->Builds.load(std::memory_order_relaxed);
+    for (const auto &S : F->Stripes) {
+      Stats.Rejected += S.Rejected.load(std::memory_order_relaxed);
+      Stats.Passed += S.Passed.load(std::memory_order_relaxed);
+      Stats.FalsePositives += S.FalsePositives.load(std::memory_order_relaxed);
+    }
+    return Stats;
+  }
+
+  // Routes emplace, the single-element inserts and erase by key (plus
+  // try_emplace and insert_or_assign on maps) through a flat combiner (see
+  // FlatCombiner.h). Under heavy write contention one thread then applies a
+  // batch of writes while the table stays in its cache, instead of every
+  // writer pulling the lock and the table over in turn. Each caller still
+  // waits for its own result. Everything else keeps taking TheMutex directly,
+  // which the combiner also holds, so the two can be mixed freely.
+  void enable_combining() {
+    combiner();
+    CombineWrites.store(true, std::memory_order_relaxed);
+  }
+
+  void disable_combining() {
+    CombineWrites.store(false, std::memory_order_relaxed);
+  }
+
+  // Runs Fn on the underlying table through the combiner, whether or not
+  // enable_combining() is in effect, and returns its result. Fn must not call
+  // back into this container. Fn may change the table in ways the Bloom filter
+  // can't follow, so like atomically() this drops the filter until it has
+  // been rebuilt; use ccombine() for callbacks that only read.
+  template <typename Fn> decltype(auto) combine(Fn &&F) {
+    return combiner().execute(
+        [&]() -> decltype(auto) { return std::invoke(F, raw()); });
+  }
+
+  // Queues Fn to run on the underlying table and returns a std::future for
+  // its result. Queued calls still run if the container is destroyed first.
+  template <typename Fn> auto combine_async(Fn &&F) {
+    return combiner().submit(
+        [this, F = std::forward<Fn>(F)]() mutable -> decltype(auto) {
+          return std::invoke(F, raw());
+        });
+  }
+
+  // Like combine() and combine_async(), but Fn gets the table as const, so
+  // the Bloom filter is kept.
+  template <typename Fn> decltype(auto) ccombine(Fn &&F) const {
+    return combiner().execute(
+        [&]() -> decltype(auto) { return std::invoke(F, std::as_const(Raw)); });
+  }
+
+  template <typename Fn> auto ccombine_async(Fn &&F) const {
+    return combiner().submit(
+        [this, F = std::forward<Fn>(F)]() mutable -> decltype(auto) {
+          return std::invoke(F, std::as_const(Raw));
+        });
+  }
+
+  // Counts the node table as usual (see Memory.h), plus the Bloom filter and
+  // the combiner as metadata when they exist.
+  MemoryUsage memory_usage() const {
+    auto Usage = [&] {
+      ReadLockTy Lock(TheMutex);
+      return detail::unorderedMemoryUsage(Raw);
+    }();
+    Usage.Metadata += sizeof(Derived);
+    if (Filtering.load(std::memory_order_acquire))
+      Usage.Metadata += sizeof(FilterState) + bloom_filter_stats().Bytes;
+    if (Combining.load(std::memory_order_acquire))
+      Usage.Metadata += sizeof(FlatCombiner<LockTy>);
+    return Usage;
+  }
+
+  // Lists this container in the MemoryRegistry under Name until it is
+  // destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  CombiningStats combining_stats() const {
+    auto *C = Combining.load(std::memory_order_acquire);
+    if (!C)
+      return {};
+    auto Stats = C->stats();
+    Stats.Enabled = CombineWrites.load(std::memory_order_relaxed);
+    return Stats;
+  }
+};
+} // namespace detail
+} // namespace threadsafe
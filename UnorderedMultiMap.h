@@ -0,0 +1,70 @@
+#pragma once
+
+#include "UnorderedBase.h"
+
+#include <functional>
+#include <unordered_map>
+
+namespace threadsafe {
+template <typename Key, typename T, typename Hash = std::hash<Key>,
+          typename Pred = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, T>>,
+          typename LockTy = DefaultLockTy>
+class UnorderedMultiMap
+    : public detail::UnorderedBase<
+          UnorderedMultiMap<Key, T, Hash, Pred, Alloc, LockTy>,
+          std::unordered_multimap<Key, T, Hash, Pred, Alloc>, LockTy> {
+  using Base =
+      detail::UnorderedBase<UnorderedMultiMap,
+                            std::unordered_multimap<Key, T, Hash, Pred, Alloc>,
+                            LockTy>;
+  using typename Base::BaseTy;
+  using typename Base::ReadLockTy;
+  using typename Base::WriteLockTy;
+  using typename Base::Probe;
+  using Base::probe;
+  using Base::Raw;
+  using Base::raw;
+  using Base::record;
+  using Base::TheMutex;
+
+  friend struct ContainerAccess;
+
+public:
+  using typename Base::key_type;
+  using typename Base::size_type;
+  using mapped_type = BaseTy::mapped_type;
+
+  using Base::Base;
+  using Base::operator=;
+
+  // Calls Fn on every element with key K under the exclusive lock and returns
+  // how many there were. Fn must not call back into the map.
+  template <typename F> size_type visit_all_of(const key_type &K, F &&Fn) {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return 0;
+    WriteLockTy Lock(TheMutex);
+    auto [First, Last] = Raw.equal_range(K);
+    record(P, First != Last);
+    size_type Visited = 0;
+    for (; First != Last; ++First, ++Visited)
+      std::invoke(Fn, *First);
+    return Visited;
+  }
+
+  template <typename F>
+  size_type cvisit_all_of(const key_type &K, F &&Fn) const {
+    auto P = probe(K);
+    if (P == Probe::Absent)
+      return 0;
+    ReadLockTy Lock(TheMutex);
+    auto [First, Last] = Raw.equal_range(K);
+    record(P, First != Last);
+    size_type Visited = 0;
+    for (; First != Last; ++First, ++Visited)
+      std::invoke(Fn, *First);
+    return Visited;
+  }
+};
+} // namespace threadsafe
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "UnorderedBase.h"
+
+#include <unordered_set>
+
+namespace threadsafe {
+template <typename Key, typename Hash = std::hash<Key>,
+          typename Pred = std::equal_to<Key>,
+          typename Alloc = std::allocator<Key>,
+          typename LockTy = DefaultLockTy>
+class UnorderedSet
+    : public detail::UnorderedBase<
+          UnorderedSet<Key, Hash, Pred, Alloc, LockTy>,
+          std::unordered_set<Key, Hash, Pred, Alloc>, LockTy> {
+  using Base =
+      detail::UnorderedBase<UnorderedSet,
+                            std::unordered_set<Key, Hash, Pred, Alloc>, LockTy>;
+  using typename Base::BaseTy;
+  using Base::raw;
+  using Base::TheMutex;
+
+  friend struct ContainerAccess;
+
+public:
+#if __cplusplus >= 201703L
+  using insert_return_type = BaseTy::insert_return_type;
+#endif
+
+  using Base::Base;
+  using Base::operator=;
+};
+} // namespace threadsafe
@@ -1,15 +1,27 @@
 #pragma once
 
+#include "Atomically.h"
+#include "Locks.h"
+#include "Memory.h"
+#include "ThreadPool.h"
+
 #include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <shared_mutex>
+#include <string>
 #include <vector>
 
 namespace threadsafe {
-template <typename T, typename Allocator = std::allocator<T>> class Vector {
+template <typename T, typename Allocator = std::allocator<T>,
+          typename LockTy = DefaultLockTy>
+class Vector {
 private:
   using BaseTy = std::vector<T, Allocator>;
+  using ReadLockTy = std::shared_lock<LockTy>;
+  using WriteLockTy = std::unique_lock<LockTy>;
 
 public:
   using value_type = BaseTy::value_type;
@@ -24,25 +36,33 @@ public:
   using const_iterator = BaseTy::const_iterator;
   using reverse_iterator = BaseTy::reverse_iterator;
   using const_reverse_iterator = BaseTy::const_reverse_iterator;
+  using lock_type = LockTy;
 
 private:
   BaseTy TheVector;
-  std::shared_mutex TheMutex;
-  std::condition_variable TheCV;
+  mutable LockTy TheMutex;
+  std::condition_variable_any TheCV;
+  // Last, so it unregisters before anything memory_usage() reads is gone.
+  MemoryRegistration Registration;
+
+  friend struct ContainerAccess;
+
+  BaseTy &raw() { return TheVector; }
+  void notifyAll() { TheCV.notify_all(); }
 
 public:
   bool empty() const {
-    std::shared_lock Lock(TheMutex);
+    ReadLockTy Lock(TheMutex);
     return std::empty(TheVector);
   }
 
   size_type size() const {
-    std::shared_lock Lock(TheMutex);
+    ReadLockTy Lock(TheMutex);
     return std::size(TheVector);
   }
 
   size_type max_size() const {
-    std::shared_lock Lock(TheMutex);
+    ReadLockTy Lock(TheMutex);
     return TheVector.max_size();
   }
 
@@ -52,43 +72,119 @@ public:
   }
 
   size_type capacity() const {
-    std::shared_lock Lock(TheMutex);
+    ReadLockTy Lock(TheMutex);
     return TheVector.capacity();
   }
 
-  void clear() const {
+  void clear() {
     std::lock_guard Lock(TheMutex);
     TheVector.clear();
   }
 
-  std::shared_mutex &mutex() { return TheMutex; }
+  LockTy &mutex() { return TheMutex; }
+
+  MemoryUsage memory_usage() const {
+    ReadLockTy Lock(TheMutex);
+    auto Usage = detail::memoryUsageOf(TheVector);
+    Usage.Metadata += sizeof(*this);
+    return Usage;
+  }
+
+  // Lists this Vector in the MemoryRegistry under Name until it is destroyed.
+  void track_memory(std::string Name) {
+    Registration.set(this, std::move(Name), [this] { return memory_usage(); });
+  }
+
+  // A copy of the elements, taken under the shared lock, for work that
+  // shouldn't hold up producers at all.
+  BaseTy snapshot() const {
+    ReadLockTy Lock(TheMutex);
+    return TheVector;
+  }
+
+  // In-place algorithms that fan out over Pool (see ThreadPool's parallel_*)
+  // under a single hold of the lock, so producers wait for the parallel
+  // running time rather than the serial one. The callbacks run on pool
+  // threads and must not touch this Vector. Other tasks on Pool may: the
+  // calling thread doesn't pick them up while it holds the lock.
+
+  template <typename Compare = std::less<>>
+  void sort(ThreadPool &Pool, Compare Comp = {}) {
+    std::lock_guard Lock(TheMutex);
+    Pool.parallel_sort(TheVector.begin(), TheVector.end(), Comp);
+  }
+
+  template <typename Compare = std::less<>>
+  void stable_sort(ThreadPool &Pool, Compare Comp = {}) {
+    std::lock_guard Lock(TheMutex);
+    Pool.parallel_stable_sort(TheVector.begin(), TheVector.end(), Comp);
+  }
+
+  // Drops consecutive duplicates and returns how many were removed.
+  template <typename BinaryPred = std::equal_to<>>
+  size_type unique(ThreadPool &Pool, BinaryPred Pred = {}) {
+    std::lock_guard Lock(TheMutex);
+    auto It = Pool.parallel_unique(TheVector.begin(), TheVector.end(), Pred);
+    auto Removed = static_cast<size_type>(TheVector.end() - It);
+    TheVector.erase(It, TheVector.end());
+    return Removed;
+  }
+
+  // Moves the elements satisfying Pred to the front and returns how many
+  // there are.
+  template <typename UnaryPred>
+  size_type partition(ThreadPool &Pool, UnaryPred Pred) {
+    std::lock_guard Lock(TheMutex);
+    return static_cast<size_type>(
+        Pool.parallel_partition(TheVector.begin(), TheVector.end(), Pred) -
+        TheVector.begin());
+  }
+
+  // Replaces every element X with Op(X).
+  template <typename UnaryOp> void transform(ThreadPool &Pool, UnaryOp Op) {
+    std::lock_guard Lock(TheMutex);
+    Pool.parallel_transform(TheVector.begin(), TheVector.end(),
+                            TheVector.begin(), Op);
+  }
+
+  // Takes only the shared lock.
+  template <typename U, typename BinaryOp = std::plus<>>
+  U reduce(ThreadPool &Pool, U Init, BinaryOp Op = {}) const {
+    ReadLockTy Lock(TheMutex);
+    return Pool.parallel_reduce(TheVector.begin(), TheVector.end(),
+                                std::move(Init), Op);
+  }
 
   bool try_pop_back(reference Value) {
     std::lock_guard Lock(TheMutex);
     if (std::empty(TheVector))
       return false;
-    Value = TheVector.back();
+    if constexpr (std::is_move_assignable_v<T>)
+      Value = std::move(TheVector.back());
+    else
+      Value = TheVector.back();
+    TheVector.pop_back();
     return true;
   }
 
   std::unique_ptr<value_type> try_pop_back() {
     std::lock_guard Lock(TheMutex);
     if (std::empty(TheVector))
-      return false;
+      return nullptr;
 
     if constexpr (std::is_move_constructible_v<value_type>) {
-      auto Value = std::make_unique(std::move(TheVector.back()));
+      auto Value = std::make_unique<value_type>(std::move(TheVector.back()));
       TheVector.pop_back();
       return Value;
     } else {
-      auto Value = std::make_unique(TheVector.back());
+      auto Value = std::make_unique<value_type>(TheVector.back());
       TheVector.pop_back();
       return Value;
     }
   }
 
   void wait_and_pop_back(reference Value) {
-    std::unique_lock Lock(TheMutex);
+    WriteLockTy Lock(TheMutex);
     TheCV.wait(Lock, [this] { return !std::empty(TheVector); });
     if constexpr (std::is_move_assignable_v<T>)
       Value = std::move(TheVector.back());
@@ -112,8 +208,9 @@ public:
   std::unique_ptr<BaseTy> try_pop(size_type Count) {
     std::lock_guard Lock(TheMutex);
     size_type N = std::min(Count, std::size(TheVector));
-    std::unique_ptr<BaseTy> Value(std::move_iterator(std::end(TheVector) - N),
-                                  std::move_iterator(std::end(TheVector)));
+    auto Value = std::make_unique<BaseTy>(
+        std::move_iterator(std::end(TheVector) - N),
+        std::move_iterator(std::end(TheVector)));
 
     TheVector.resize(std::size(TheVector) - N);
 
@@ -142,8 +239,9 @@ public:
       return nullptr;
 
     size_type N = std::min(Count, std::size(TheVector));
-    std::unique_ptr<BaseTy> Value(std::move_iterator(std::end(TheVector) - N),
-                                  std::move_iterator(std::end(TheVector)));
+    auto Value = std::make_unique<BaseTy>(
+        std::move_iterator(std::end(TheVector) - N),
+        std::move_iterator(std::end(TheVector)));
 
     TheVector.resize(std::size(TheVector) - N);
 
@@ -151,23 +249,35 @@ public:
   }
 
   void push_back(const T &Value) {
-    std::lock_guard Lock(TheMutex);
-    TheVector.push_back(Value);
+    {
+      std::lock_guard Lock(TheMutex);
+      TheVector.push_back(Value);
+    }
+    TheCV.notify_one();
   }
 
   void push_back(T &&Value) {
-    std::lock_guard Lock(TheMutex);
-    TheVector.push_back(std::forward<T>(Value));
+    {
+      std::lock_guard Lock(TheMutex);
+      TheVector.push_back(std::forward<T>(Value));
+    }
+    TheCV.notify_one();
   }
 
   template <typename... ArgsTy> void push(ArgsTy &&...Args) {
-    std::lock_guard Lock(TheMutex);
-    (TheVector.push_back(std::forward<ArgsTy>(Args)), ...);
+    {
+      std::lock_guard Lock(TheMutex);
+      (TheVector.push_back(std::forward<ArgsTy>(Args)), ...);
+    }
+    TheCV.notify_all();
   }
 
   template <typename... ArgsTy> void emplace_back(ArgsTy &&...Args) {
-    std::lock_guard Lock(TheMutex);
-    TheVector.emplace_back(std::forward<ArgsTy>(Args)...);
+    {
+      std::lock_guard Lock(TheMutex);
+      TheVector.emplace_back(std::forward<ArgsTy>(Args)...);
+    }
+    TheCV.notify_one();
   }
 };
-} // namespace threadsafe
\ No newline at end of file
+} // namespace threadsafe
@@ -0,0 +1,607 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Array.h"
+#include "AtomicArray.h"
+#include "HugePages.h"
+#include "Queue.h"
+#include "SeqlockArray.h"
+#include "ShardedQueue.h"
+#include "UnorderedMap.h"
+#include "Vector.h"
+
+namespace {
+using ClockTy = std::chrono::steady_clock;
+
+// Log-linear latency histogram: 32 sub-buckets per power of two, so any
+// recorded value is reported within ~3%.
+class Histogram {
+  static constexpr unsigned SubBits = 5;
+  static constexpr unsigned SubBuckets = 1u << SubBits;
+  std::array<std::uint64_t, 64 * SubBuckets> Counts{};
+  std::uint64_t Total = 0;
+
+  static unsigned index(std::uint64_t V) {
+    if (V < SubBuckets)
+      return static_cast<unsigned>(V);
+    unsigned Exp = std::bit_width(V) - 1 - SubBits;
+    return (Exp + 1) * SubBuckets +
+           static_cast<unsigned>((V >> Exp) & (SubBuckets - 1));
+  }
+
+  static std::uint64_t value(unsigned I) {
+    if (I < SubBuckets)
+      return I;
+    unsigned Exp = I / SubBuckets - 1;
+    return (std::uint64_t(SubBuckets) + I % SubBuckets) << Exp;
+  }
+
+public:
+  void record(std::uint64_t Nanos) {
+    ++Counts[index(Nanos)];
+    ++Total;
+  }
+
+  void merge(const Histogram &Other) {
+    for (std::size_t I = 0; I != Counts.size(); ++I)
+      Counts[I] += Other.Counts[I];
+    Total += Other.Total;
+  }
+
+  std::uint64_t count() const { return Total; }
+
+  std::uint64_t percentile(double Q) const {
+    if (Total == 0)
+      return 0;
+    auto Target = static_cast<std::uint64_t>(std::ceil(Q * Total));
+    std::uint64_t Seen = 0;
+    for (unsigned I = 0; I != Counts.size(); ++I) {
+      Seen += Counts[I];
+      if (Seen >= std::max<std::uint64_t>(Target, 1))
+        return value(I);
+    }
+    return value(Counts.size() - 1);
+  }
+};
+
+// Zipfian generator over [0, N) (Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases"), as used by YCSB.
+class Zipfian {
+  std::uint64_t N;
+  double Theta, Alpha, ZetaN, Eta;
+
+  static double zeta(std::uint64_t N, double Theta) {
+    double Sum = 0;
+    for (std::uint64_t I = 1; I <= N; ++I)
+      Sum += 1.0 / std::pow(double(I), Theta);
+    return Sum;
+  }
+
+public:
+  Zipfian(std::uint64_t N, double Theta = 0.99)
+      : N(N), Theta(Theta), Alpha(1.0 / (1.0 - Theta)), ZetaN(zeta(N, Theta)),
+        Eta((1.0 - std::pow(2.0 / N, 1.0 - Theta)) /
+            (1.0 - zeta(2, Theta) / ZetaN)) {}
+
+  template <typename RNG> std::uint64_t operator()(RNG &R) const {
+    double U = std::uniform_real_distribution<double>(0, 1)(R);
+    double UZ = U * ZetaN;
+    if (UZ < 1.0)
+      return 0;
+    if (UZ < 1.0 + std::pow(0.5, Theta))
+      return 1;
+    return std::min<std::uint64_t>(
+        N - 1, static_cast<std::uint64_t>(
+                   N * std::pow(Eta * U - Eta + 1.0, Alpha)));
+  }
+};
+
+struct Options {
+  unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+  unsigned DurationMs = 200;
+  std::string Filter;
+  std::string CsvPath;
+  std::string JsonPath;
+};
+
+struct Result {
+  std::string Name;
+  std::string Params;
+  unsigned Threads;
+  double OpsPerSec;
+  std::uint64_t P50, P99, P999;
+};
+
+// Per-thread body: called repeatedly with (thread index, iteration, rng).
+using OpTy = std::function<void(unsigned, std::uint64_t, std::mt19937_64 &)>;
+
+Result runTimed(const Options &Opts, const std::string &Name,
+                const std::string &Params, unsigned Threads,
+                const std::function<OpTy(unsigned)> &MakeOp) {
+  std::vector<Histogram> Hists(Threads);
+  std::vector<std::uint64_t> Ops(Threads);
+  std::atomic<unsigned> Ready{0};
+  std::atomic<bool> Go{false}, Stop{false};
+
+  std::vector<std::thread> Workers;
+  for (unsigned T = 0; T != Threads; ++T)
+    Workers.emplace_back([&, T] {
+      auto Op = MakeOp(T);
+      std::mt19937_64 Rng(0x5eed + T);
+      auto &H = Hists[T];
+      std::uint64_t I = 0;
+      Ready.fetch_add(1);
+      while (!Go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      while (!Stop.load(std::memory_order_relaxed)) {
+        auto Start = ClockTy::now();
+        Op(T, I, Rng);
+        auto End = ClockTy::now();
+        H.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     End - Start)
+                     .count());
+        ++I;
+      }
+      Ops[T] = I;
+    });
+
+  while (Ready.load() != Threads)
+    std::this_thread::yield();
+  auto Begin = ClockTy::now();
+  Go.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::milliseconds(Opts.DurationMs));
+  Stop.store(true);
+  for (auto &W : Workers)
+    W.join();
+  double Secs = std::chrono::duration<double>(ClockTy::now() - Begin).count();
+
+  Histogram All;
+  std::uint64_t Total = 0;
+  for (unsigned T = 0; T != Threads; ++T) {
+    All.merge(Hists[T]);
+    Total += Ops[T];
+  }
+  return {Name,
+          Params,
+          Threads,
+          Total / Secs,
+          All.percentile(0.5),
+          All.percentile(0.99),
+          All.percentile(0.999)};
+}
+
+std::vector<unsigned> threadCounts(const Options &Opts) {
+  std::vector<unsigned> Counts;
+  for (unsigned T = 1; T < Opts.MaxThreads; T *= 2)
+    Counts.push_back(T);
+  Counts.push_back(Opts.MaxThreads);
+  return Counts;
+}
+
+class Suite {
+  const Options &Opts;
+  std::vector<Result> Results;
+
+public:
+  explicit Suite(const Options &Opts) : Opts(Opts) {}
+
+  bool enabled(const std::string &Name, const std::string &Params) const {
+    return Opts.Filter.empty() ||
+           (Name + "/" + Params).find(Opts.Filter) != std::string::npos;
+  }
+
+  // Runs the benchmark for every thread count. Setup is called once per
+  // thread count and returns the per-thread op factory.
+  template <typename SetupTy>
+  void run(const std::string &Name, const std::string &Params,
+           SetupTy &&Setup) {
+    if (!enabled(Name, Params))
+      return;
+    for (auto Threads : threadCounts(Opts)) {
+      auto State = Setup(Threads);
+      auto R = runTimed(Opts, Name, Params, Threads,
+                        [&](unsigned T) { return State->op(T); });
+      std::printf("%-14s %-52s %3u %14.0f %8llu %8llu %8llu\n",
+                  R.Name.c_str(), R.Params.c_str(), R.Threads, R.OpsPerSec,
+                  (unsigned long long)R.P50, (unsigned long long)R.P99,
+                  (unsigned long long)R.P999);
+      std::fflush(stdout);
+      Results.push_back(std::move(R));
+    }
+  }
+
+  void writeCsv(const std::string &Path) const {
+    auto *F = std::fopen(Path.c_str(), "w");
+    if (!F) {
+      std::perror(Path.c_str());
+      return;
+    }
+    std::fprintf(F, "name,params,threads,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for (auto &R : Results)
+      std::fprintf(F, "%s,\"%s\",%u,%.0f,%llu,%llu,%llu\n", R.Name.c_str(),
+                   R.Params.c_str(), R.Threads, R.OpsPerSec,
+                   (unsigned long long)R.P50, (unsigned long long)R.P99,
+                   (unsigned long long)R.P999);
+    std::fclose(F);
+  }
+
+  void writeJson(const std::string &Path) const {
+    auto *F = std::fopen(Path.c_str(), "w");
+    if (!F) {
+      std::perror(Path.c_str());
+      return;
+    }
+    std::fprintf(F, "[\n");
+    for (std::size_t I = 0; I != Results.size(); ++I) {
+      auto &R = Results[I];
+      std::fprintf(F,
+                   "  {\"name\": \"%s\", \"params\": \"%s\", \"threads\": %u, "
+                   "\"ops_per_sec\": %.0f, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+                   "\"p999_ns\": %llu}%s\n",
+                   R.Name.c_str(), R.Params.c_str(), R.Threads, R.OpsPerSec,
+                   (unsigned long long)R.P50, (unsigned long long)R.P99,
+                   (unsigned long long)R.P999,
+                   I + 1 == Results.size() ? "" : ",");
+    }
+    std::fprintf(F, "]\n");
+    std::fclose(F);
+  }
+};
+
+template <typename LockTy>
+using MapTy =
+    threadsafe::UnorderedMap<std::uint64_t, std::uint64_t,
+                             std::hash<std::uint64_t>,
+                             std::equal_to<std::uint64_t>,
+                             std::allocator<std::pair<const std::uint64_t,
+                                                      std::uint64_t>>,
+                             LockTy>;
+
+template <typename LockTy>
+void benchMap(Suite &S, const char *LockName, std::uint64_t Size,
+              unsigned ReadPct, bool Zipf) {
+  struct State {
+    MapTy<LockTy> Map;
+    std::uint64_t Size;
+    unsigned ReadPct;
+    std::unique_ptr<Zipfian> Dist;
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &R) {
+        auto Key = Dist ? (*Dist)(R) : R() % Size;
+        if (R() % 100 < ReadPct)
+          (void)Map.contains(Key);
+        else
+          Map.insert_or_assign(Key, Key);
+      };
+    }
+  };
+
+  // The Zipfian constant is expensive to compute, so share it across runs.
+  auto Dist = Zipf ? std::make_shared<Zipfian>(Size) : nullptr;
+  auto Params = std::string("lock=") + LockName +
+                " size=" + std::to_string(Size) +
+                " read=" + std::to_string(ReadPct) +
+                (Zipf ? " dist=zipf" : " dist=uniform");
+  S.run("UnorderedMap", Params, [&](unsigned) {
+    auto St = std::make_unique<State>();
+    St->Size = Size;
+    St->ReadPct = ReadPct;
+    if (Dist)
+      St->Dist = std::make_unique<Zipfian>(*Dist);
+    St->Map.reserve(Size);
+    for (std::uint64_t K = 0; K < Size; K += 2)
+      St->Map.emplace(K, K);
+    return St;
+  });
+}
+
+// Lookups of absent keys, the case the Bloom filter exists for.
+void benchMapMisses(Suite &S, std::uint64_t Size, bool Bloom) {
+  struct State {
+    MapTy<threadsafe::SharedMutexLock> Map;
+    std::uint64_t Size;
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &R) {
+        (void)Map.contains(R() % Size | 1);
+      };
+    }
+  };
+
+  auto Params = std::string("op=miss size=") + std::to_string(Size) +
+                (Bloom ? " bloom=on" : " bloom=off");
+  S.run("UnorderedMap", Params, [&](unsigned) {
+    auto St = std::make_unique<State>();
+    St->Size = Size;
+    St->Map.reserve(Size);
+    for (std::uint64_t K = 0; K < Size; K += 2)
+      St->Map.emplace(K, K);
+    if (Bloom)
+      St->Map.enable_bloom_filter();
+    return St;
+  });
+}
+
+// Writes only, where lock handoff dominates and flat combining should help.
+void benchMapWrites(Suite &S, std::uint64_t Size, bool Combining) {
+  struct State {
+    MapTy<threadsafe::SharedMutexLock> Map;
+    std::uint64_t Size;
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &R) {
+        auto Key = R() % Size;
+        Map.insert_or_assign(Key, Key);
+      };
+    }
+  };
+
+  auto Params = std::string("op=write size=") + std::to_string(Size) +
+                (Combining ? " combining=on" : " combining=off");
+  S.run("UnorderedMap", Params, [&](unsigned) {
+    auto St = std::make_unique<State>();
+    St->Size = Size;
+    St->Map.reserve(Size);
+    if (Combining)
+      St->Map.enable_combining();
+    return St;
+  });
+}
+
+// Uniform hits over a map far bigger than the TLB covers with 4 KiB pages,
+// so most lookups miss the TLB on the bucket and again on the node.
+template <typename AllocTy>
+void benchMapPages(Suite &S, std::uint64_t Size, const char *Pages) {
+  struct State {
+    threadsafe::UnorderedMap<std::uint64_t, std::uint64_t,
+                             std::hash<std::uint64_t>,
+                             std::equal_to<std::uint64_t>, AllocTy,
+                             threadsafe::SharedMutexLock>
+        Map;
+    std::uint64_t Size;
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &R) {
+        (void)Map.contains(R() % Size);
+      };
+    }
+  };
+
+  auto Params = std::string("op=hit size=") + std::to_string(Size) +
+                " pages=" + Pages;
+  S.run("UnorderedMap", Params, [&](unsigned) {
+    auto St = std::make_unique<State>();
+    St->Size = Size;
+    St->Map.reserve(Size);
+    for (std::uint64_t K = 0; K < Size; ++K)
+      St->Map.emplace(K, K);
+    return St;
+  });
+}
+
+template <typename LockTy> void benchVector(Suite &S, const char *LockName) {
+  struct State {
+    threadsafe::Vector<std::uint64_t, std::allocator<std::uint64_t>, LockTy>
+        Vec;
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t I, std::mt19937_64 &) {
+        if (I & 1) {
+          std::uint64_t V;
+          (void)Vec.try_pop_back(V);
+        } else {
+          Vec.push_back(I);
+        }
+      };
+    }
+  };
+  S.run("Vector", std::string("lock=") + LockName + " op=push/pop",
+        [](unsigned) { return std::make_unique<State>(); });
+}
+
+// Producer/consumer split of the thread count: 1 producer / rest consumers,
+// half and half, or rest producers / 1 consumer.
+template <typename LockTy>
+void benchQueue(Suite &S, const char *LockName, const char *Topology) {
+  struct State {
+    threadsafe::Queue<std::uint64_t, std::allocator<std::uint64_t>, LockTy> Q;
+    unsigned Producers;
+
+    OpTy op(unsigned T) {
+      if (T < Producers)
+        return [this](unsigned, std::uint64_t I, std::mt19937_64 &) {
+          Q.push(I);
+        };
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &) {
+        std::uint64_t V;
+        (void)Q.try_pop(V);
+      };
+    }
+  };
+  std::string Topo = Topology;
+  S.run("Queue", std::string("lock=") + LockName + " topology=" + Topo,
+        [&](unsigned Threads) {
+          auto St = std::make_unique<State>();
+          if (Threads == 1)
+            St->Producers = 1;
+          else if (Topo == "1P-NC")
+            St->Producers = 1;
+          else if (Topo == "NP-1C")
+            St->Producers = Threads - 1;
+          else
+            St->Producers = Threads / 2;
+          return St;
+        });
+}
+
+// Same NP-NC mix as benchQueue, with one queue per CPU.
+void benchShardedQueue(Suite &S) {
+  struct State {
+    threadsafe::ShardedQueue<std::uint64_t> Q;
+    unsigned Producers;
+
+    OpTy op(unsigned T) {
+      if (T < Producers)
+        return [this](unsigned, std::uint64_t I, std::mt19937_64 &) {
+          Q.push(I);
+        };
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &) {
+        std::uint64_t V;
+        (void)Q.try_pop(V);
+      };
+    }
+  };
+  S.run("ShardedQueue", "lock=SpinLock topology=NP-NC", [](unsigned Threads) {
+    auto St = std::make_unique<State>();
+    St->Producers = std::max(1u, Threads / 2);
+    return St;
+  });
+}
+
+template <bool Padded> void benchAtomicArray(Suite &S) {
+  struct State {
+    threadsafe::AtomicArray<std::uint64_t, 64, Padded> Counters;
+
+    OpTy op(unsigned) {
+      return [this](unsigned T, std::uint64_t, std::mt19937_64 &) {
+        Counters.fetch_add(T % 64, 1, std::memory_order_relaxed);
+      };
+    }
+  };
+  S.run("AtomicArray", Padded ? "op=fetch_add padded" : "op=fetch_add packed",
+        [](unsigned) { return std::make_unique<State>(); });
+}
+
+void benchSeqlockArray(Suite &S) {
+  struct Rate {
+    std::uint64_t Limit, Burst;
+  };
+  struct State {
+    threadsafe::SeqlockArray<Rate, 64> Rates;
+
+    OpTy op(unsigned T) {
+      if (T == 0)
+        return [this](unsigned, std::uint64_t I, std::mt19937_64 &) {
+          if (I % 1024 == 0)
+            Rates.store(I % 64, Rate{I, I});
+          else
+            (void)Rates.load(I % 64);
+        };
+      return [this](unsigned, std::uint64_t I, std::mt19937_64 &) {
+        (void)Rates.load(I % 64);
+      };
+    }
+  };
+  S.run("SeqlockArray", "op=load writer=1/1024",
+        [](unsigned) { return std::make_unique<State>(); });
+}
+
+void benchArraySum(Suite &S) {
+  struct State {
+    threadsafe::Array<std::uint32_t, 4096, threadsafe::SharedMutexLock> A{};
+
+    OpTy op(unsigned) {
+      return [this](unsigned, std::uint64_t, std::mt19937_64 &) {
+        volatile auto Sum = A.sum();
+        (void)Sum;
+      };
+    }
+  };
+  S.run("Array", "op=sum n=4096 lock=SharedMutexLock",
+        [](unsigned) { return std::make_unique<State>(); });
+}
+
+void usage(const char *Argv0) {
+  std::fprintf(stderr,
+               "usage: %s [--threads N] [--duration-ms MS] [--filter STR] "
+               "[--csv FILE] [--json FILE]\n",
+               Argv0);
+}
+} // namespace
+
+int main(int Argc, char **Argv) {
+  Options Opts;
+  for (int I = 1; I < Argc; ++I) {
+    std::string Arg = Argv[I];
+    auto Next = [&]() -> const char * {
+      if (I + 1 >= Argc) {
+        usage(Argv[0]);
+        std::exit(1);
+      }
+      return Argv[++I];
+    };
+    if (Arg == "--threads")
+      Opts.MaxThreads = std::max(1, std::atoi(Next()));
+    else if (Arg == "--duration-ms")
+      Opts.DurationMs = std::max(1, std::atoi(Next()));
+    else if (Arg == "--filter")
+      Opts.Filter = Next();
+    else if (Arg == "--csv")
+      Opts.CsvPath = Next();
+    else if (Arg == "--json")
+      Opts.JsonPath = Next();
+    else {
+      usage(Argv[0]);
+      return Arg == "--help" ? 0 : 1;
+    }
+  }
+
+  std::printf("%-14s %-52s %3s %14s %8s %8s %8s\n", "benchmark", "params",
+              "thr", "ops/s", "p50ns", "p99ns", "p999ns");
+
+  Suite S(Opts);
+  for (std::uint64_t Size : {1u << 10, 1u << 20})
+    for (unsigned ReadPct : {100u, 90u, 50u})
+      for (bool Zipf : {false, true}) {
+        benchMap<threadsafe::SharedMutexLock>(S, "SharedMutexLock", Size,
+                                              ReadPct, Zipf);
+        benchMap<threadsafe::BravoLock<>>(S, "BravoLock", Size, ReadPct,
+                                          Zipf);
+        benchMap<threadsafe::SpinLock>(S, "SpinLock", Size, ReadPct, Zipf);
+      }
+  for (std::uint64_t Size : {1u << 10, 1u << 20})
+    for (bool Bloom : {false, true})
+      benchMapMisses(S, Size, Bloom);
+  for (bool Combining : {false, true})
+    benchMapWrites(S, 1u << 16, Combining);
+  {
+    using ValueTy = std::pair<const std::uint64_t, std::uint64_t>;
+    benchMapPages<std::allocator<ValueTy>>(S, 1u << 22, "small");
+    benchMapPages<threadsafe::HugePageAllocator<ValueTy>>(S, 1u << 22, "huge");
+  }
+
+  benchVector<threadsafe::SharedMutexLock>(S, "SharedMutexLock");
+  benchVector<threadsafe::SpinLock>(S, "SpinLock");
+  benchVector<threadsafe::MCSLock>(S, "MCSLock");
+
+  for (auto *Topology : {"1P-NC", "NP-NC", "NP-1C"}) {
+    benchQueue<threadsafe::SharedMutexLock>(S, "SharedMutexLock", Topology);
+    benchQueue<threadsafe::TicketLock>(S, "TicketLock", Topology);
+  }
+  benchShardedQueue(S);
+
+  benchAtomicArray<true>(S);
+  benchAtomicArray<false>(S);
+  benchSeqlockArray(S);
+  benchArraySum(S);
+
+  if (!Opts.CsvPath.empty())
+    S.writeCsv(Opts.CsvPath);
+  if (!Opts.JsonPath.empty())
+    S.writeJson(Opts.JsonPath);
+}
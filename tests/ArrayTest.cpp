@@ -0,0 +1,85 @@
+#include "TestUtil.h"
+
+#include "Array.h"
+#include "AtomicBitset.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <random>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+// The vectorized kernels must agree with a plain loop for every element type
+// and for lengths that aren't a multiple of the vector width.
+template <typename T, std::size_t N> static void checkKernels() {
+  Array<T, N> A, B;
+  std::mt19937 R(N);
+  for (auto &X : A.Raw)
+    X = T(R() % 50);
+  for (auto &X : B.Raw)
+    X = T(R() % 3);
+  T Sum = 0;
+  std::size_t Sevens = 0, FirstSet = N;
+  for (std::size_t I = 0; I != N; ++I) {
+    Sum += A.Raw[I];
+    Sevens += A.Raw[I] == T(7);
+    if (FirstSet == N && B.Raw[I] != T(0))
+      FirstSet = I;
+  }
+  // An 8-bit total overflows at these lengths.
+  if constexpr (sizeof(T) > 1)
+    CHECK(A.sum() == Sum);
+  CHECK(A.count(T(7)) == Sevens);
+  CHECK(A.min() == *std::min_element(A.Raw.begin(), A.Raw.end()));
+  CHECK(A.max() == *std::max_element(A.Raw.begin(), A.Raw.end()));
+  CHECK(B.find_first_set() == FirstSet);
+  auto Old = A.Raw;
+  A.add(B);
+  for (std::size_t I = 0; I != N; ++I)
+    CHECK(A.Raw[I] == T(Old[I] + B.Raw[I]));
+}
+
+static void testArray() {
+  checkKernels<int, 1000>();
+  checkKernels<std::int8_t, 1000>();
+  checkKernels<std::uint16_t, 513>();
+  checkKernels<std::int64_t, 100>();
+  checkKernels<float, 37>();
+  checkKernels<double, 3>();
+
+  Array<int, 4> A{{1, 2, 3, 4}, {}};
+  static_assert(sizeof(A) == 4 * sizeof(int));
+  CHECK(A.sum() == 10);
+  A.fill(2);
+  CHECK(A.sum() == 8);
+}
+
+static void testBitset() {
+  AtomicBitset<130> B;
+  CHECK(B.none() && B.find_first_set() == 130);
+  B.set(65);
+  CHECK(B.test(65) && B.find_first_set() == 65 && B.find_first_set(66) == 130);
+  CHECK(B.find_first_free(65) == 66);
+  B.flip(65);
+  CHECK(B.none());
+
+  // Concurrent acquires hand out every bit exactly once.
+  std::atomic<int> Got{0};
+  runThreads(4, [&](unsigned) {
+    for (int I = 0; I != 40; ++I)
+      if (B.acquire() != 130)
+        ++Got;
+  });
+  CHECK(Got == 130 && B.all() && B.count() == 130 && B.acquire() == 130);
+  B.release(77);
+  CHECK(B.find_first_free() == 77 && B.acquire() == 77);
+  B.clear();
+  CHECK(B.none());
+}
+
+int main() {
+  testArray();
+  testBitset();
+}
@@ -0,0 +1,63 @@
+#include "TestUtil.h"
+
+#include "AtomicArray.h"
+
+#include <cstddef>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+namespace {
+struct Big {
+  long A, B, C;
+  bool operator==(const Big &) const = default;
+};
+} // namespace
+
+static void testSingleThreaded() {
+  AtomicArray<long, 8> A;
+  static_assert(sizeof(A) == 8 * CacheLineSize);
+  static_assert(sizeof(AtomicArray<int, 8, false>) == 8 * sizeof(int));
+  A.store(0, 5);
+  CHECK(A.load(0) == 5 && A.exchange(0, 6) == 5);
+  long Expected = 6;
+  CHECK(A.compare_exchange(0, Expected, 7) && A.load(0) == 7);
+  CHECK(!A.compare_exchange(0, Expected, 8) && Expected == 7);
+  A.fill(1);
+  long Sum = 0;
+  A.for_each([&](std::size_t, long X) { Sum += X; });
+  CHECK(Sum == 8);
+
+  AtomicArray<double, 2> D(1.5);
+  D.fetch_add(0, 1.0);
+  CHECK(D.load(0) == 2.5 && D.load(1) == 1.5);
+}
+
+static void testStress() {
+  AtomicArray<long, 8> A;
+  runThreads(4, [&](unsigned T) {
+    for (int I = 0; I != 20000; ++I) {
+      A.fetch_add(T, 1);
+      A.update(7, [](long X) { return X + 2; });
+    }
+  });
+  CHECK(A.load(0) == 20000 && A.load(7) == 160000);
+
+  // Elements too wide for a lock-free atomic fall back to the lock.
+  AtomicArray<Big, 4> B;
+  static_assert(!decltype(B)::LockFree);
+  runThreads(4, [&](unsigned) {
+    for (int I = 0; I != 5000; ++I)
+      B.update(1, [](Big X) {
+        ++X.A;
+        return X;
+      });
+  });
+  Big Old{20000, 0, 0};
+  CHECK(B.compare_exchange(1, Old, Big{1, 2, 3}) && B.at(1).C == 3);
+}
+
+int main() {
+  testSingleThreaded();
+  testStress();
+}
@@ -0,0 +1,250 @@
+#include "TestUtil.h"
+
+#include "Array.h"
+#include "AtomicArray.h"
+#include "Atomically.h"
+#include "Locks.h"
+#include "PriorityQueue.h"
+#include "Queue.h"
+#include "SeqlockArray.h"
+#include "UnorderedMap.h"
+#include "Vector.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+template <typename LockTy>
+using IntMap = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                            std::allocator<std::pair<const int, int>>, LockTy>;
+
+template <typename LockTy> static void checkMutualExclusion() {
+  LockTy L;
+  CHECK(L.try_lock());
+  L.unlock();
+
+  // A plain counter only adds up if the lock serializes the increments.
+  long Counter = 0;
+  std::atomic<int> Inside{0};
+  runThreads(4, [&](unsigned) {
+    for (int I = 0; I != 5000; ++I) {
+      std::lock_guard Lock(L);
+      CHECK(Inside.fetch_add(1) == 0);
+      ++Counter;
+      Inside.fetch_sub(1);
+    }
+  });
+  CHECK(Counter == 20000);
+}
+
+template <typename LockTy> static void checkReaderWriter() {
+  LockTy L;
+  CHECK(L.try_lock_shared());
+  CHECK(L.try_lock_shared());
+  CHECK(!L.try_lock());
+  L.unlock_shared();
+  L.unlock_shared();
+
+  // Readers may overlap each other but never a writer.
+  long Value = 0;
+  std::atomic<int> Writers{0};
+  runThreads(4, [&](unsigned T) {
+    for (int I = 0; I != 5000; ++I) {
+      if (T == 0 && I % 10 == 0) {
+        std::lock_guard Lock(L);
+        CHECK(Writers.fetch_add(1) == 0);
+        ++Value;
+        Writers.fetch_sub(1);
+      } else {
+        std::shared_lock Lock(L);
+        CHECK(Writers.load() == 0);
+        (void)Value;
+      }
+    }
+  });
+  CHECK(Value == 500);
+}
+
+static void testBravo() {
+  BravoLock<> A, B;
+  // A thread may hold fast-path read locks on several locks at once.
+  A.lock_shared();
+  B.lock_shared();
+  A.unlock_shared();
+  B.unlock_shared();
+  // A writer revokes the bias; readers still get in afterwards.
+  B.lock();
+  CHECK(!B.read_biased());
+  B.unlock();
+  CHECK(B.try_lock_shared());
+  B.unlock_shared();
+}
+
+static void testMCSNodeLimit() {
+  std::array<MCSLock, 17> Locks;
+  for (std::size_t I = 0; I != 16; ++I)
+    Locks[I].lock();
+  bool Threw = false;
+  try {
+    Locks[16].lock();
+  } catch (const std::length_error &) {
+    Threw = true;
+  }
+  CHECK(Threw);
+  for (std::size_t I = 0; I != 16; ++I)
+    Locks[I].unlock();
+  // The failed attempt leaked no node.
+  std::scoped_lock All(Locks[0], Locks[1], Locks[16]);
+}
+
+// If a later lock throws, atomically() must release the earlier ones.
+static void testAtomicallyReleasesOnThrow() {
+  using MCSQueue = Queue<int, std::allocator<int>, MCSLock>;
+  std::array<MCSLock, 15> Held;
+  MCSQueue A, B;
+  for (auto &L : Held)
+    L.lock();
+  bool Threw = false;
+  try {
+    atomically(A, B, [](auto &, auto &) {});
+  } catch (const std::length_error &) {
+    Threw = true;
+  }
+  for (auto &L : Held)
+    L.unlock();
+  CHECK(Threw);
+  A.push(1);
+  atomically(A, B, [](std::queue<int> &QA, std::queue<int> &QB) {
+    QB.push(QA.front());
+    QA.pop();
+  });
+  CHECK(A.empty() && B.size() == 1);
+}
+
+static void testAtomicallyStress() {
+  UnorderedMap<int, int> A, B;
+  UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+               std::allocator<std::pair<const int, int>>, SpinLock>
+      C;
+  for (int I = 0; I != 1000; ++I)
+    A.emplace(I, I);
+  // Opposite orders would deadlock without the global lock order.
+  runThreads(4, [&](unsigned T) {
+    for (int I = 0; I != 1000; ++I) {
+      if (T % 2) {
+        A.transfer(I, B);
+        B.transfer(I, C);
+      } else {
+        C.transfer(I, A);
+        B.transfer(I, A);
+      }
+    }
+  });
+  CHECK(A.size() + B.size() + C.size() == 1000);
+
+  Queue<int> Q;
+  Vector<int> V;
+  for (int I = 0; I != 10; ++I)
+    Q.push(I);
+  runThreads(4, [&](unsigned) {
+    for (int K = 0; K != 100; ++K)
+      atomically(Q, V, [](std::queue<int> &RQ, std::vector<int> &RV) {
+        if (!RQ.empty()) {
+          RV.push_back(RQ.front());
+          RQ.pop();
+        }
+      });
+  });
+  CHECK(V.size() == 10 && Q.empty());
+  CHECK(atomically(A, A, [](auto &X, auto &Y) { return &X == &Y; }));
+}
+
+// The containers work with every lock policy, exclusive-only ones included.
+template <typename LockTy> static void checkContainers() {
+  IntMap<LockTy> M;
+  Vector<int, std::allocator<int>, LockTy> V;
+  Queue<int, std::allocator<int>, LockTy> Q;
+  runThreads(4, [&](unsigned T) {
+    for (int I = 0; I != 2000; ++I) {
+      M.emplace(T * 2000 + I, I);
+      V.push_back(I);
+      Q.push(I);
+      (void)M.contains(I);
+    }
+  });
+  CHECK(M.size() == 8000 && V.size() == 8000 && Q.size() == 8000);
+  int X;
+  CHECK(V.try_pop_back(X) && V.size() == 7999);
+  CHECK(V.try_pop_back() && V.try_pop(10)->size() == 10);
+  decltype(M) Copy;
+  Copy = M;
+  CHECK(Copy.size() == 8000);
+
+  V.clear();
+  std::jthread Consumer([&] {
+    int Y;
+    V.wait_and_pop_back(Y);
+    CHECK(Y == 5);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  V.push_back(5);
+}
+
+static void testOtherPolicies() {
+  IntMap<NullLock> M;
+  M.emplace(1, 2);
+  CHECK(M.at(1) == 2);
+
+  Array<int, 4, SpinLock> A{}, B{};
+  A.fill(1);
+  A.swap(B);
+  CHECK(B.sum() == 4 && A.sum() == 0);
+
+  PriorityQueue<int, std::less<int>, SpinLock> P(2, 2);
+  P.push(1);
+  int Z;
+  CHECK(P.try_pop(Z) && Z == 1);
+
+  AtomicArray<std::array<long, 3>, 4, true, TicketLock> AA;
+  AA.update(0, [](auto X) {
+    ++X[0];
+    return X;
+  });
+  CHECK(AA.load(0)[0] == 1);
+
+  SeqlockArray<int, 4, SpinLock> S;
+  S.store(1, 5);
+  CHECK(S.load(1) == 5);
+}
+
+int main() {
+  checkMutualExclusion<SpinLock>();
+  checkMutualExclusion<TicketLock>();
+  checkMutualExclusion<MCSLock>();
+  checkMutualExclusion<SharedMutexLock>();
+  checkMutualExclusion<BravoLock<>>();
+  checkReaderWriter<SharedMutexLock>();
+  checkReaderWriter<BravoLock<>>();
+  testBravo();
+  testMCSNodeLimit();
+  testAtomicallyReleasesOnThrow();
+  testAtomicallyStress();
+  checkContainers<SharedMutexLock>();
+  checkContainers<SpinLock>();
+  checkContainers<TicketLock>();
+  checkContainers<MCSLock>();
+  checkContainers<BravoLock<>>();
+  testOtherPolicies();
+}
@@ -0,0 +1,172 @@
+#include "TestUtil.h"
+
+#include "Atomically.h"
+#include "HugePages.h"
+#include "Memory.h"
+#include "OrderedMap.h"
+#include "Queue.h"
+#include "ShardedVector.h"
+#include "UnorderedMap.h"
+#include "UnorderedSet.h"
+#include "Vector.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+static void testMemoryUsage() {
+  Vector<int> V;
+  V.reserve(100);
+  V.push_back(1);
+  auto U = V.memory_usage();
+  CHECK(U.Payload == sizeof(int) && U.Wasted == 99 * sizeof(int));
+  CHECK(!U.Tracked);
+
+  Vector<int, TrackingAllocator<int>> TV;
+  for (int I = 0; I != 1000; ++I)
+    TV.push_back(I);
+  U = TV.memory_usage();
+  CHECK(U.Tracked && U.Payload == 1000 * sizeof(int));
+  CHECK(U.Peak >= 1024 * sizeof(int));
+  TV.clear();
+  CHECK(TV.memory_usage().Payload == 0);
+
+  Queue<std::string, TrackingAllocator<std::string>> Q;
+  for (int I = 0; I != 100; ++I)
+    Q.push("x");
+  CHECK(Q.memory_usage().Payload == 100 * sizeof(std::string));
+
+  OrderedMap<int, int> OM;
+  for (int I = 0; I != 1000; ++I)
+    OM.insert({I, I});
+  for (int I = 0; I != 500; ++I)
+    OM.erase(I);
+  CHECK(OM.memory_usage().Payload == 500 * sizeof(std::pair<const int, int>));
+
+  ShardedVector<int, TrackingAllocator<int>> SV(4);
+  SV.push_back(1);
+  CHECK(SV.memory_usage().Tracked && SV.memory_usage().Payload == sizeof(int));
+}
+
+static void testRegistry() {
+  auto &R = MemoryRegistry::instance();
+  UnorderedMap<int, int> A;
+  Vector<int> V;
+  A.track_memory("a");
+  V.track_memory("v");
+  {
+    Queue<int> Tmp;
+    Tmp.track_memory("tmp");
+    CHECK(R.collect().size() == 3);
+  }
+  CHECK(R.collect().size() == 2);
+
+  // Reports race with writers and with containers coming and going, some of
+  // them destroyed while another container's lock is held.
+  std::atomic<bool> Stop{false};
+  runThreads(2, [&](unsigned T) {
+    if (T == 0) {
+      while (!Stop)
+        (void)R.total();
+      return;
+    }
+    for (int I = 0; I != 500; ++I) {
+      auto B = std::make_unique<Queue<int>>();
+      B->track_memory("b");
+      atomically(A, [&](auto &Raw) {
+        Raw[I] = I;
+        B.reset();
+        Queue<int> C;
+        C.track_memory("c");
+      });
+      V.push_back(I);
+    }
+    Stop = true;
+  });
+  CHECK(R.collect().size() == 2);
+  std::FILE *Null = std::fopen("/dev/null", "w");
+  CHECK(Null);
+  R.dump(Null);
+  std::fclose(Null);
+}
+
+static void testHugePageAllocator() {
+  {
+    HugePageAllocator<int> A;
+    // Zero-sized requests get distinct, valid pointers.
+    int *P = A.allocate(0), *Q = A.allocate(0);
+    CHECK(P && Q && P != Q);
+    A.deallocate(P, 0);
+    A.deallocate(Q, 0);
+    bool Threw = false;
+    try {
+      (void)A.allocate(A.max_size() + 1);
+    } catch (const std::bad_array_new_length &) {
+      Threw = true;
+    }
+    CHECK(Threw);
+
+    // Small blocks come back from the pool.
+    int *S = A.allocate(16);
+    A.deallocate(S, 16);
+    CHECK(A.allocate(16) == S);
+    A.deallocate(S, 16);
+  }
+  // Pool chunks go back when the last allocator sharing the pool dies.
+  CHECK(hugePageStats().mapped() == 0);
+
+  {
+    Vector<std::uint64_t, HugePageAllocator<std::uint64_t>> V;
+    for (std::uint64_t I = 0; I != (1u << 18); ++I)
+      V.push_back(I);
+    CHECK(hugePageStats().mapped() >= (1u << 18) * sizeof(std::uint64_t));
+  }
+  CHECK(hugePageStats().mapped() == 0);
+
+  // Threads allocate and free through the shared pools concurrently.
+  {
+    using Alloc = HugePageAllocator<std::pair<const int, std::string>>;
+    UnorderedMap<int, std::string, std::hash<int>, std::equal_to<int>, Alloc>
+        M;
+    runThreads(4, [&](unsigned T) {
+      for (int I = 0; I != 5000; ++I) {
+        int K = T * 5000 + I;
+        M.emplace(K, std::to_string(K));
+        if (I % 2)
+          M.erase(K);
+      }
+    });
+    CHECK(M.size() == 10000);
+    auto Copy = M;
+    CHECK(Copy.size() == 10000 && Copy.contains(2));
+  }
+  CHECK(hugePageStats().mapped() == 0 && hugePageStats().UpstreamBytes == 0);
+
+  // Composes with the tracking allocator.
+  {
+    Vector<int, TrackingAllocator<int, HugePageAllocator<int>>> V;
+    for (int I = 0; I != 100000; ++I)
+      V.push_back(I);
+    auto U = V.memory_usage();
+    CHECK(U.Tracked && U.Payload == 100000 * sizeof(int));
+    UnorderedSet<int, std::hash<int>, std::equal_to<int>,
+                 TrackingAllocator<int, HugePageAllocator<int>>>
+        S;
+    for (int I = 0; I != 1000; ++I)
+      S.insert(I);
+    CHECK(S.memory_usage().Tracked);
+  }
+  CHECK(hugePageStats().mapped() == 0);
+}
+
+int main() {
+  testMemoryUsage();
+  testRegistry();
+  testHugePageAllocator();
+}
@@ -0,0 +1,163 @@
+#include "TestUtil.h"
+
+#include "Epoch.h"
+#include "OrderedMap.h"
+
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+static void testAgainstStdMap() {
+  OrderedMap<int, std::string> M{{3, "c"}, {1, "a"}, {2, "b"}};
+  CHECK(M.size() == 3);
+  CHECK(!M.insert({2, "x"}).second);
+  CHECK(!M.insert_or_assign(2, std::string("bb")).second);
+  CHECK((*M.find(2)).second == "bb" && M.find(5) == M.end());
+  CHECK(M.lower_bound(2).key() == 2 && M.upper_bound(2).key() == 3);
+  CHECK(M.upper_bound(3) == M.end());
+  CHECK(M.erase(2) == 1 && M.erase(2) == 0 && !M.contains(2));
+  CHECK(M.visit(1, [](auto &V) { V.second += "!"; }));
+  std::string Cat;
+  CHECK(M.range(0, 10, [&](const auto &V) { Cat += V.second; }) == 2);
+  CHECK(Cat == "a!c");
+  M.clear();
+  CHECK(M.empty() && M.begin() == M.end());
+
+  // Random operations agree with std::map, including iteration order.
+  OrderedMap<int, int> O;
+  std::map<int, int> Ref;
+  std::mt19937 R(7);
+  for (int I = 0; I != 20000; ++I) {
+    int K = R() % 2000;
+    switch (R() % 3) {
+    case 0:
+      CHECK(O.try_emplace(K, I).second == Ref.try_emplace(K, I).second);
+      break;
+    case 1:
+      O.insert_or_assign(K, I);
+      Ref.insert_or_assign(K, I);
+      break;
+    default:
+      CHECK(O.erase(K) == Ref.erase(K));
+    }
+  }
+  CHECK(O.size() == Ref.size());
+  auto It = Ref.begin();
+  for (auto OIt = O.begin(); OIt != O.end(); ++OIt, ++It)
+    CHECK(OIt.key() == It->first && (*OIt).second == It->second);
+  CHECK(It == Ref.end());
+  auto Lo = Ref.lower_bound(500), Hi = Ref.lower_bound(1500);
+  CHECK(O.range(500, 1500, [](const auto &) {}) ==
+        std::size_t(std::distance(Lo, Hi)));
+}
+
+static void testConcurrentWriters() {
+  // Disjoint inserts all land, in order.
+  constexpr int Threads = 4, Keys = 20000;
+  OrderedMap<int, int> D;
+  runThreads(Threads, [&](unsigned T) {
+    for (int I = T; I < Keys; I += Threads)
+      CHECK(D.try_emplace(I, I).second);
+  });
+  CHECK(D.size() == Keys);
+  int Expected = 0;
+  for (auto It = D.begin(); It != D.end(); ++It)
+    CHECK(It.key() == Expected++);
+
+  // Scanners race with inserts and erases of the same keys; every node they
+  // reach is either live or still waiting to be reclaimed.
+  OrderedMap<long, long> C;
+  std::atomic<int> Writing{Threads};
+  runThreads(Threads + 1, [&](unsigned T) {
+    if (T == Threads) {
+      while (Writing.load() != 0) {
+        long Prev = -1;
+        for (auto It = C.begin(); It != C.end(); ++It) {
+          CHECK(It.key() > Prev);
+          Prev = It.key();
+          CHECK((*It).second == It.key() * 2);
+        }
+        C.range(100, 200, [](const auto &V) {
+          CHECK(V.first >= 100 && V.first < 200);
+        });
+      }
+      return;
+    }
+    for (int I = 0; I != 10000; ++I) {
+      long K = (I * 7919L + T) % 2000;
+      if (I % 3 == 2)
+        C.erase(K);
+      else
+        C.insert_or_assign(K, K * 2);
+      C.visit(K, [](auto &V) { CHECK(V.second == V.first * 2); });
+    }
+    Writing.fetch_sub(1);
+  });
+  std::size_t N = 0;
+  for (auto It = C.begin(); It != C.end(); ++It)
+    ++N;
+  CHECK(N == C.size());
+}
+
+static std::atomic<int> Deleted{0};
+
+static void countingDelete(void *P) {
+  delete static_cast<int *>(P);
+  Deleted.fetch_add(1);
+}
+
+static void testEpochReclamation() {
+  EpochDomain E;
+  auto G = E.pin();
+  E.retire(new int(1), countingDelete);
+  // Nothing retired while a reader is pinned may be freed.
+  for (int I = 0; I != 4; ++I)
+    E.reclaim();
+  CHECK(Deleted == 0 && E.pending() == 1);
+  G.reset();
+  for (int I = 0; I != 4; ++I)
+    E.reclaim();
+  CHECK(Deleted == 1 && E.pending() == 0);
+
+  // An iterator keeps an erased node alive.
+  OrderedMap<int, std::string> M{{1, "one"}, {2, "two"}};
+  auto It = M.find(2);
+  std::jthread([&] {
+    CHECK(M.erase(2) == 1);
+    // Enough retirements to trigger several reclamation scans.
+    for (int I = 0; I != 200; ++I) {
+      M.insert_or_assign(100 + I, std::string(32, 'x'));
+      M.erase(100 + I);
+    }
+  }).join();
+  CHECK((*It).second == "two");
+
+  // Readers pin and unpin while writers retire; nothing leaks.
+  {
+    EpochDomain D;
+    Deleted = 0;
+    runThreads(4, [&](unsigned T) {
+      for (int I = 0; I != 2000; ++I) {
+        auto Pin = D.pin();
+        if (T % 2)
+          D.retire(new int(I), countingDelete);
+      }
+    });
+    D.reclaim();
+    CHECK(std::size_t(Deleted.load()) + D.pending() == 4000);
+  }
+  CHECK(Deleted == 4000);
+}
+
+int main() {
+  testAgainstStdMap();
+  testConcurrentWriters();
+  testEpochReclamation();
+}
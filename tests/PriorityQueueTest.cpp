@@ -0,0 +1,68 @@
+#include "TestUtil.h"
+
+#include "PriorityQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+static void testStrictOrder() {
+  PriorityQueue<int> Q(StrictOrder);
+  CHECK(Q.empty() && !Q.try_pop());
+  for (int I : {5, 1, 9, 3, 7})
+    Q.push(I);
+  CHECK(Q.size() == 5);
+  int V;
+  for (int Expected : {9, 7, 5, 3, 1})
+    CHECK(Q.try_pop(V) && V == Expected);
+  CHECK(!Q.try_pop(V) && Q.empty());
+
+  PriorityQueue<int, std::greater<int>> Min(StrictOrder);
+  Min.emplace(2);
+  Min.push(1);
+  CHECK(*Min.try_pop() == 1 && *Min.try_pop() == 2);
+}
+
+static void testRelaxedStress() {
+  constexpr int Threads = 4, PerThread = 10000;
+  PriorityQueue<int> Q(2, Threads);
+  runThreads(Threads, [&](unsigned T) {
+    for (int I = 0; I != PerThread; ++I)
+      Q.push(int(T) * PerThread + I);
+  });
+  CHECK(Q.size() == Threads * PerThread);
+
+  // The order is relaxed, but every element comes out exactly once.
+  std::vector<std::atomic<int>> Seen(Threads * PerThread);
+  runThreads(Threads, [&](unsigned) {
+    int V;
+    while (Q.try_pop(V))
+      Seen[V].fetch_add(1);
+  });
+  for (auto &S : Seen)
+    CHECK(S.load() == 1);
+  CHECK(Q.empty());
+}
+
+static void testWaitAndPop() {
+  PriorityQueue<int> Q(2, 2);
+  std::jthread Consumer([&] {
+    int V;
+    Q.wait_and_pop(V);
+    CHECK(V + *Q.wait_and_pop() == 85);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Q.push(42);
+  Q.push(43);
+}
+
+int main() {
+  testStrictOrder();
+  testRelaxedStress();
+  testWaitAndPop();
+}
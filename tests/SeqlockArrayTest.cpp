@@ -0,0 +1,65 @@
+#include "TestUtil.h"
+
+#include "SeqlockArray.h"
+
+#include <atomic>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+namespace {
+struct Rate {
+  int A;
+  double B;
+  char C[5];
+};
+} // namespace
+
+static void testSingleThreaded() {
+  SeqlockArray<Rate, 64> R;
+  R.store(3, Rate{1, 2.0, {}});
+  CHECK(R.load(3).A == 1 && R[3].B == 2.0 && R.version() == 1);
+  R.update(3, [](Rate &X) { X.A = 2; });
+  CHECK(R.load(3).A == 2 && R.version() == 2);
+  R.fill(Rate{7, 14.0, {}});
+  auto S = R.snapshot();
+  CHECK(S[0].A == 7 && S[63].B == 14.0 && R.version() == 3);
+
+  SeqlockValue<long> V(5);
+  V.update([](long &X) { X += 1; });
+  CHECK(V.load() == 6);
+}
+
+// Readers never see a half-written update, of one element or of the whole
+// array.
+static void testTornReads() {
+  SeqlockArray<Rate, 64> R;
+  constexpr int Writes = 5000;
+  std::atomic<bool> Done{false};
+  runThreads(3, [&](unsigned T) {
+    if (T == 0) {
+      for (int K = 1; K <= Writes; ++K)
+        R.update([K](auto &V) {
+          for (auto &X : V) {
+            X.A = K;
+            X.B = K * 2.0;
+          }
+        });
+      Done = true;
+      return;
+    }
+    while (!Done) {
+      auto S = R.snapshot();
+      for (auto &X : S)
+        CHECK(X.A == S[0].A && X.B == 2.0 * S[0].A);
+      auto E = R.load(5);
+      CHECK(E.B == 2.0 * E.A);
+    }
+  });
+  CHECK(R.load(63).A == Writes && R.version() == Writes);
+}
+
+int main() {
+  testSingleThreaded();
+  testTornReads();
+}
@@ -0,0 +1,133 @@
+#include "TestUtil.h"
+
+#include "Queue.h"
+#include "ShardedQueue.h"
+#include "ShardedVector.h"
+#include "Vector.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+static void testQueueAndVector() {
+  Queue<int> Q;
+  CHECK(Q.empty() && !Q.try_pop());
+  for (int I = 0; I != 10; ++I)
+    Q.push(I);
+  int V;
+  CHECK(Q.try_pop(V) && V == 0 && *Q.wait_and_pop() == 1 && Q.size() == 8);
+
+  Vector<int> Vec;
+  for (int I = 0; I != 100; ++I)
+    Vec.push_back(I);
+  CHECK(Vec.try_pop_back(V) && V == 99 && Vec.size() == 99);
+  CHECK(*Vec.try_pop_back() == 98 && Vec.try_pop(10)->size() == 10);
+  CHECK(Vec.snapshot().back() == 87);
+
+  // Blocked consumers wake up on push.
+  while (Q.try_pop())
+    ;
+  Vec.clear();
+  std::jthread Consumer([&] {
+    int X;
+    Q.wait_and_pop(X);
+    Vec.wait_and_pop_back(X);
+    CHECK(X == 5);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Q.push(1);
+  Vec.push_back(5);
+}
+
+static void testShardedQueue() {
+  ShardedQueue<int> Q(8);
+  CHECK(Q.shard_count() == 8 && Q.empty());
+  // A single producer's elements come out in order.
+  for (int I = 0; I != 10; ++I)
+    Q.push(I);
+  int V;
+  for (int I = 0; I != 10; ++I)
+    CHECK(Q.try_pop(V) && V == I);
+  CHECK(!Q.try_pop(V) && !Q.try_pop());
+
+  // Producers and consumers on different shards; consumers steal, and every
+  // element is delivered exactly once.
+  constexpr int Producers = 4, Consumers = 3, PerProducer = 10000;
+  constexpr int Total = Producers * PerProducer;
+  std::vector<std::atomic<int>> Seen(Total);
+  std::atomic<int> Delivered{0};
+  runThreads(Producers + Consumers, [&](unsigned T) {
+    if (T < Producers) {
+      for (int I = 0; I != PerProducer; ++I)
+        Q.emplace(int(T) * PerProducer + I);
+      return;
+    }
+    int X;
+    while (Delivered.load() != Total) {
+      if (!Q.try_pop(X)) {
+        std::this_thread::yield();
+        continue;
+      }
+      Seen[X].fetch_add(1);
+      Delivered.fetch_add(1);
+    }
+  });
+  for (auto &S : Seen)
+    CHECK(S.load() == 1);
+  CHECK(Q.empty());
+
+  std::jthread Consumer([&] { CHECK(*Q.wait_and_pop() == 42); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  Q.push(42);
+}
+
+static void testShardedVector() {
+  ShardedVector<std::unique_ptr<int>> P(4);
+  P.emplace_back(std::make_unique<int>(3));
+  auto U = P.try_pop_back();
+  CHECK(U && **U == 3 && !P.try_pop_back());
+
+  ShardedVector<int> V;
+  V.reserve(16);
+  V.push(1, 2, 3);
+  V.push_back(4);
+  CHECK(V.size() == 4);
+  std::vector<int> Out;
+  CHECK(V.try_pop(3, Out) == 3 && V.size() == 1);
+  CHECK(V.try_pop(5, Out) == 1 && V.empty());
+
+  // Concurrent pushes and pops balance out.
+  std::atomic<long> Balance{0};
+  runThreads(6, [&](unsigned T) {
+    for (int K = 0; K != 10000; ++K) {
+      int X;
+      if ((K + T) % 2)
+        V.push_back(1);
+      else if (V.try_pop_back(X))
+        Balance -= X;
+    }
+  });
+  int X;
+  while (V.try_pop_back(X))
+    Balance -= X;
+  CHECK(Balance == -30000);
+
+  std::jthread Consumer([&] {
+    int Y;
+    V.wait_and_pop_back(Y);
+    CHECK(Y == 9);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  V.push_back(9);
+}
+
+int main() {
+  testQueueAndVector();
+  testShardedQueue();
+  testShardedVector();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// Unlike assert, stays on in release builds.
+#define CHECK(Cond)                                                            \
+  do {                                                                         \
+    if (!(Cond)) {                                                             \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                   #Cond);                                                     \
+      std::abort();                                                            \
+    }                                                                          \
+  } while (false)
+
+namespace threadsafe::test {
+// Runs Fn(I) on N threads, I in [0, N), and joins them.
+template <typename Fn> void runThreads(unsigned N, Fn F) {
+  std::vector<std::jthread> Threads;
+  for (unsigned I = 0; I != N; ++I)
+    Threads.emplace_back([&F, I] { F(I); });
+}
+} // namespace threadsafe::test
@@ -0,0 +1,216 @@
+#include "TestUtil.h"
+
+#include "Locks.h"
+#include "ThreadPool.h"
+#include "Vector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+static void testDequeSingleThreaded() {
+  WorkStealingDeque<int> D(2);
+  CHECK(D.empty());
+  for (int I = 0; I != 100; ++I)
+    D.push(I);
+  CHECK(D.size() == 100);
+  int V;
+  // The owner pops LIFO, thieves take from the other end.
+  CHECK(D.try_pop(V) && V == 99);
+  CHECK(D.try_steal(V) && V == 0);
+  CHECK(D.try_steal(V) && V == 1);
+  for (int I = 98; I != 1; --I)
+    CHECK(D.try_pop(V) && V == I);
+  CHECK(!D.try_pop(V) && !D.try_steal(V) && D.empty());
+}
+
+static void testDequeStress() {
+  constexpr int N = 100000;
+  constexpr unsigned Thieves = 3;
+  WorkStealingDeque<int> D;
+  std::vector<std::atomic<int>> Seen(N);
+  std::atomic<bool> Done{false};
+  runThreads(Thieves + 1, [&](unsigned T) {
+    int V;
+    if (T == 0) {
+      // The owner pushes everything and pops some of it back.
+      for (int I = 0; I != N; ++I) {
+        D.push(I);
+        if (I % 3 == 0 && D.try_pop(V))
+          Seen[V].fetch_add(1);
+      }
+      while (D.try_pop(V))
+        Seen[V].fetch_add(1);
+      Done = true;
+      return;
+    }
+    while (!Done || !D.empty())
+      if (D.try_steal(V))
+        Seen[V].fetch_add(1);
+  });
+  for (auto &S : Seen)
+    CHECK(S.load() == 1);
+}
+
+static void testSubmitAndParallelFor() {
+  ThreadPool Pool(4);
+  CHECK(Pool.submit([](int A, int B) { return A + B; }, 2, 3).get() == 5);
+
+  std::vector<long> V(100000);
+  Pool.parallel_for(0, int(V.size()), [&](int I) { V[I] = I; });
+  CHECK(std::accumulate(V.begin(), V.end(), 0L) == 99999L * 100000 / 2);
+
+  // Nested calls make progress even when every worker is blocked in one.
+  std::atomic<long> Sum{0};
+  Pool.parallel_for(
+      0, 100,
+      [&](int I) {
+        Pool.parallel_for(0, 1000, [&](int J) { Sum += long(I) * J; }, 10);
+      },
+      1);
+  CHECK(Sum == 4950L * 499500);
+
+  bool Threw = false;
+  try {
+    Pool.parallel_for(0, 100000, [](int I) {
+      if (I == 77777)
+        throw I;
+    });
+  } catch (int I) {
+    Threw = I == 77777;
+  }
+  CHECK(Threw);
+
+  std::vector<std::future<int>> Fs;
+  for (int I = 0; I != 1000; ++I)
+    Fs.push_back(Pool.submit([I] { return I; }));
+  long Total = 0;
+  for (auto &F : Fs)
+    Total += F.get();
+  CHECK(Total == 999L * 500);
+}
+
+// A waiting caller runs only its own chunks, so it may hold a lock that other
+// queued tasks need.
+static void testParallelForWithLockHeld() {
+  ThreadPool Pool(1);
+  std::mutex Mutex;
+  std::vector<std::future<void>> Fs;
+  {
+    std::lock_guard Lock(Mutex);
+    for (int I = 0; I != 100; ++I)
+      Fs.push_back(Pool.submit([&] { std::lock_guard Inner(Mutex); }));
+    std::atomic<int> Sum{0};
+    Pool.parallel_for(0, 1000, [&](int I) { Sum += I; }, 10);
+    CHECK(Sum == 999 * 500);
+  }
+  for (auto &F : Fs)
+    F.get();
+}
+
+static void testSubmitStress() {
+  ThreadPool Pool(4);
+  std::atomic<int> Count{0};
+  runThreads(4, [&](unsigned) {
+    std::vector<std::future<void>> Fs;
+    for (int I = 0; I != 2000; ++I)
+      Fs.push_back(Pool.submit([&] { Count.fetch_add(1); }));
+    for (auto &F : Fs)
+      F.get();
+  });
+  CHECK(Count == 8000);
+}
+
+static void testAlgorithms() {
+  ThreadPool Pool(4);
+  std::mt19937 R(1);
+  auto ByFirst = [](const auto &L, const auto &R) { return L.first < R.first; };
+  auto Div3 = [](int X) { return X % 3 == 0; };
+  for (std::size_t N : {0u, 1u, 10u, 5000u, 100003u}) {
+    std::vector<int> Base(N);
+    for (auto &X : Base)
+      X = R() % 1000;
+
+    auto Sorted = Base;
+    std::sort(Sorted.begin(), Sorted.end());
+    auto A = Base;
+    Pool.parallel_sort(A.begin(), A.end());
+    CHECK(A == Sorted);
+
+    std::vector<std::pair<int, int>> P(N);
+    for (std::size_t I = 0; I != N; ++I)
+      P[I] = {Base[I] % 17, int(I)};
+    auto Stable = P;
+    std::stable_sort(Stable.begin(), Stable.end(), ByFirst);
+    Pool.parallel_stable_sort(P.begin(), P.end(), ByFirst);
+    CHECK(P == Stable);
+
+    auto U = A;
+    U.erase(Pool.parallel_unique(U.begin(), U.end()), U.end());
+    auto Expected = A;
+    Expected.erase(std::unique(Expected.begin(), Expected.end()),
+                   Expected.end());
+    CHECK(U == Expected);
+
+    auto Pa = Base;
+    auto It = Pool.parallel_partition(Pa.begin(), Pa.end(), Div3);
+    CHECK(std::is_partitioned(Pa.begin(), Pa.end(), Div3));
+    CHECK(It - Pa.begin() == std::count_if(Base.begin(), Base.end(), Div3));
+
+    std::vector<long> T(N);
+    Pool.parallel_transform(Base.begin(), Base.end(), T.begin(),
+                            [](int X) { return 2L * X; });
+    for (std::size_t I = 0; I != N; ++I)
+      CHECK(T[I] == 2L * Base[I]);
+
+    CHECK(Pool.parallel_reduce(Base.begin(), Base.end(), 0L) ==
+          std::accumulate(Base.begin(), Base.end(), 0L));
+    // Non-commutative operations keep their order.
+    std::vector<std::string> S(N);
+    for (std::size_t I = 0; I != N; ++I)
+      S[I] = std::string(1, char('a' + I % 26));
+    CHECK(Pool.parallel_reduce(S.begin(), S.end(), std::string()) ==
+          std::accumulate(S.begin(), S.end(), std::string()));
+  }
+}
+
+// A parallel sort must not run the pool's other tasks while it holds the
+// Vector's lock, or those that touch the Vector deadlock.
+template <typename LockTy> static void testVectorSortWithQueuedTasks() {
+  ThreadPool Pool(1);
+  Vector<int, std::allocator<int>, LockTy> V;
+  std::mt19937 R(1);
+  for (int I = 0; I != 20000; ++I)
+    V.push_back(R() % 1000);
+  std::vector<std::future<void>> Fs;
+  for (int I = 0; I != 500; ++I)
+    Fs.push_back(Pool.submit([&] { V.push_back(1); }));
+  V.sort(Pool);
+  for (auto &F : Fs)
+    F.get();
+  CHECK(V.size() == 20500);
+}
+
+int main() {
+  testDequeSingleThreaded();
+  testDequeStress();
+  testSubmitAndParallelFor();
+  testParallelForWithLockHeld();
+  testSubmitStress();
+  testAlgorithms();
+  testVectorSortWithQueuedTasks<SharedMutexLock>();
+  testVectorSortWithQueuedTasks<SpinLock>();
+  testVectorSortWithQueuedTasks<TicketLock>();
+  testVectorSortWithQueuedTasks<MCSLock>();
+}
@@ -0,0 +1,295 @@
+#include "TestUtil.h"
+
+#include "Atomically.h"
+#include "BloomFilter.h"
+#include "FlatCombiner.h"
+#include "UnorderedMap.h"
+#include "UnorderedMultiMap.h"
+#include "UnorderedSet.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace threadsafe;
+using threadsafe::test::runThreads;
+
+template <typename LockTy>
+using IntMap = UnorderedMap<int, int, std::hash<int>, std::equal_to<int>,
+                            std::allocator<std::pair<const int, int>>, LockTy>;
+
+static void testMap() {
+  UnorderedMap<int, std::string> M{{1, "a"}, {2, "b"}, {3, "c"}};
+  CHECK(M.size() == 3 && M.at(2) == "b");
+  M[4] = "d";
+  CHECK(!M.try_emplace(4, "x").second);
+  CHECK(M.visit(1, [](auto &V) { V.second += "!"; }) && M.at(1) == "a!");
+  CHECK(!M.cvisit(9, [](const auto &) {}));
+
+  std::vector<int> Keys{1, 2, 9};
+  std::vector<bool> Has;
+  M.contains_batch(Keys, std::back_inserter(Has));
+  CHECK((Has == std::vector<bool>{true, true, false}));
+  CHECK(M.visit_batch(Keys, [](auto &V) { V.second += "?"; }) == 2);
+  CHECK(M.erase_batch(Keys) == 2 && M.size() == 2);
+  CHECK(M.erase_if([](auto &V) { return V.first == 3; }) == 1);
+  std::vector<std::pair<int, std::string>> Batch{{5, "e"}, {6, "f"}, {4, "x"}};
+  CHECK(M.insert_batch(Batch) == 2);
+
+  auto Copy = M;
+  UnorderedMap<int, std::string> Other;
+  Other.swap(Copy);
+  CHECK(Other.size() == 3 && Copy.empty());
+  CHECK(Other.transfer(5, Copy) && Copy.contains(5) && !Other.contains(5));
+  std::unordered_map<int, std::string> Src{{7, "g"}};
+  Copy.merge(Src);
+  CHECK(Copy.contains(7) && Src.empty());
+}
+
+static void testSetAndMultiMap() {
+  UnorderedSet<std::string> S{"x", "y"};
+  CHECK(!S.insert("x").second && S.insert("z").second && S.size() == 3);
+  std::vector<std::string> Keys{"x", "q"};
+  CHECK(S.cvisit_batch(Keys, [](const std::string &) {}) == 1);
+  CHECK(S.erase_batch(Keys) == 1 && S.visit_all([](auto &) {}) == 2);
+
+  UnorderedMultiMap<int, int> MM{{1, 10}, {1, 11}, {2, 20}};
+  MM.insert({1, 12});
+  int Sum = 0;
+  CHECK(MM.visit_all_of(1, [&](auto &V) { Sum += V.second; }) == 3);
+  CHECK(Sum == 33 && MM.count(1) == 3);
+  CHECK(MM.erase_batch(std::vector<int>{1}) == 3 && MM.size() == 1);
+}
+
+template <typename LockTy> static void checkStress() {
+  IntMap<LockTy> M;
+  UnorderedSet<int> S;
+  runThreads(4, [&](unsigned T) {
+    std::vector<int> Batch;
+    for (int I = 0; I != 2000; ++I) {
+      int K = T * 2000 + I;
+      CHECK(M.emplace(K, I).second);
+      CHECK(!M.try_emplace(K, -1).second);
+      if (I % 3 == 0)
+        CHECK(M.erase(K) == 1);
+      (void)M.contains(I);
+      Batch.push_back(K);
+    }
+    S.insert_batch(Batch);
+    S.cvisit_all([](int) {});
+  });
+  CHECK(S.size() == 8000);
+  for (int K = 0; K != 8000; ++K)
+    CHECK(M.contains(K) == (K % 2000 % 3 != 0));
+}
+
+template <typename Map> static void waitForBuilds(Map &M, std::size_t N) {
+  for (int I = 0; I != 2000 && M.bloom_filter_stats().Builds < N; ++I)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void testBloomFilter() {
+  BloomFilter F(1000);
+  for (std::uint64_t H = 0; H != 1000; ++H)
+    F.insert(H * 0x9E3779B97F4A7C15ull);
+  for (std::uint64_t H = 0; H != 1000; ++H)
+    CHECK(F.may_contain(H * 0x9E3779B97F4A7C15ull));
+
+  UnorderedMap<int, int> M;
+  for (int I = 0; I != 10000; ++I)
+    M.emplace(I, I);
+  CHECK(!M.bloom_filter_stats().Enabled);
+  M.enable_bloom_filter();
+  CHECK(M.bloom_filter_stats().Enabled && M.bloom_filter_stats().Builds == 1);
+  for (int I = 0; I != 10000; ++I)
+    CHECK(M.contains(I));
+  for (int I = 10000; I != 60000; ++I)
+    CHECK(!M.contains(I));
+  auto Stats = M.bloom_filter_stats();
+  CHECK(Stats.Rejected > 0 && Stats.false_positive_rate() < 0.05);
+
+  // Growth rebuilds in the background without hiding any key.
+  for (int I = 100000; I != 120000; ++I)
+    M.emplace(I, I);
+  waitForBuilds(M, 2);
+  CHECK(M.bloom_filter_stats().Builds >= 2);
+  for (int I = 100000; I != 120000; ++I)
+    CHECK(M.contains(I));
+
+  UnorderedSet<int> S{1, 2, 3};
+  S.enable_bloom_filter();
+  CHECK(S.contains(2) && !S.contains(7));
+  M.disable_bloom_filter();
+  CHECK(!M.bloom_filter_stats().Enabled && M.contains(1));
+
+  // Readers never see a false negative for a key published before the read.
+  UnorderedMap<int, int> C;
+  C.enable_bloom_filter();
+  std::atomic<int> Published{-1};
+  std::atomic<bool> Stop{false};
+  runThreads(3, [&](unsigned T) {
+    if (T == 0) {
+      for (int I = 0; I != 20000; ++I) {
+        C.emplace(I, I);
+        Published.store(I, std::memory_order_release);
+        // Erasures elsewhere trigger rebuilds while the readers run.
+        C.emplace(-I - 1, I);
+        if (I % 7 == 0)
+          C.erase(-I + 999);
+      }
+      Stop = true;
+      return;
+    }
+    while (!Stop) {
+      int P = Published.load(std::memory_order_acquire);
+      if (P >= 0)
+        CHECK(C.contains(P));
+    }
+  });
+}
+
+namespace {
+std::atomic<bool> FailHashing{false};
+
+struct FlakyHash {
+  std::size_t operator()(int K) const {
+    if (FailHashing && K >= 0)
+      throw std::bad_alloc();
+    return std::hash<int>()(K);
+  }
+};
+} // namespace
+
+// swap() is noexcept; if the filters can't be rebuilt on the spot they are
+// bypassed until a later rebuild succeeds, never left stale.
+static void testSwapWithFailingRebuild() {
+  UnorderedMap<int, int, FlakyHash> A, B;
+  for (int I = 0; I != 1000; ++I) {
+    A.emplace(I, I);
+    B.emplace(-I - 1, I);
+  }
+  A.enable_bloom_filter();
+  B.enable_bloom_filter();
+  static_assert(noexcept(A.swap(B)));
+  FailHashing = true;
+  A.swap(B);
+  FailHashing = false;
+  for (int I = 0; I != 1000; ++I)
+    CHECK(B.contains(I) && A.contains(-I - 1) && !A.contains(I));
+  A.rebuild_bloom_filter();
+  B.rebuild_bloom_filter();
+  for (int I = 0; I != 1000; ++I)
+    CHECK(B.contains(I) && A.contains(-I - 1));
+}
+
+// atomically() drops the filter and asks for a rebuild. A request that comes
+// in just as an earlier rebuild finishes must still bring the filter back.
+static void testRawDuringRebuild() {
+  UnorderedMap<int, int> M;
+  for (int I = 0; I != 1000; ++I)
+    M.emplace(I, I);
+  M.enable_bloom_filter();
+  // A lost request stops the rebuilds for good, so Builds stalls below 200.
+  for (int I = 0; I != 100000 && M.bloom_filter_stats().Builds < 200; ++I) {
+    atomically(M, [&](auto &Raw) { Raw.insert_or_assign(I % 1000, I); });
+    std::this_thread::yield();
+  }
+  for (int I = 0; I != 2000 && !M.bloom_filter_stats().Enabled; ++I)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  CHECK(M.bloom_filter_stats().Enabled);
+  auto Rejected = M.bloom_filter_stats().Rejected;
+  for (int I = 1000; I != 2000; ++I)
+    CHECK(!M.contains(I));
+  CHECK(M.bloom_filter_stats().Rejected > Rejected);
+}
+
+static void testFlatCombiner() {
+  std::mutex Mutex;
+  long Counter = 0;
+  {
+    FlatCombiner<std::mutex> FC(Mutex);
+    CHECK(FC.execute([&] { return ++Counter; }) == 1);
+    bool Threw = false;
+    try {
+      FC.execute([]() -> int { throw std::runtime_error("x"); });
+    } catch (const std::runtime_error &) {
+      Threw = true;
+    }
+    CHECK(Threw);
+
+    std::vector<std::future<long>> Fs;
+    runThreads(8, [&](unsigned) {
+      for (int I = 0; I != 2000; ++I)
+        FC.execute([&] { return ++Counter; });
+    });
+    for (int I = 0; I != 100; ++I)
+      Fs.push_back(FC.submit([&] { return ++Counter; }));
+    for (auto &F : Fs)
+      (void)F.get();
+    auto S = FC.stats();
+    CHECK(S.Combined + S.Direct > 0);
+  }
+  CHECK(Counter == 1 + 8 * 2000 + 100);
+}
+
+static void testCombining() {
+  UnorderedMap<int, int> M;
+  M.enable_combining();
+  M.enable_bloom_filter();
+  CHECK(M.combining_stats().Enabled);
+  runThreads(8, [&](unsigned T) {
+    for (int K = 0; K != 1000; ++K) {
+      int Key = T * 1000 + K;
+      CHECK(M.emplace(Key, 0).second);
+      CHECK(!M.insert_or_assign(Key, K).second);
+      if (K % 3 == 0)
+        CHECK(M.erase(Key) == 1);
+      // Read-only combined calls leave the filter in place.
+      auto Count = [Key](const auto &Raw) { return Raw.count(Key); };
+      CHECK(M.ccombine(Count) == (K % 3 != 0));
+      CHECK(M.ccombine_async(Count).get() == (K % 3 != 0));
+    }
+  });
+  for (int Key = 0; Key != 8000; ++Key)
+    CHECK(M.contains(Key) == (Key % 1000 % 3 != 0));
+  CHECK(M.bloom_filter_stats().Enabled);
+
+  CHECK(M.combine([](auto &Raw) { return Raw.size(); }) == M.size());
+  M.combine([](auto &Raw) { Raw.emplace(-1, -1); });
+  CHECK(M.contains(-1));
+  std::future<void> Last;
+  {
+    UnorderedMap<int, int> D;
+    for (int K = 0; K != 100; ++K)
+      Last = D.combine_async([K](auto &Raw) { Raw.emplace(K, K); });
+  }
+  // Pending requests run before the container goes away.
+  Last.get();
+  M.disable_combining();
+  CHECK(!M.combining_stats().Enabled);
+}
+
+int main() {
+  testMap();
+  testSetAndMultiMap();
+  checkStress<SharedMutexLock>();
+  checkStress<SpinLock>();
+  checkStress<BravoLock<>>();
+  testBloomFilter();
+  testSwapWithFailingRebuild();
+  testRawDuringRebuild();
+  testFlatCombiner();
+  testCombining();
+}